@@ -0,0 +1,128 @@
+#include "accel.h"
+#include "i2c.h"
+#include "pins.h"
+#include "lis2hh12_registers.h"
+#include "shared.h"
+#include <stdint.h>
+
+#define CTRL1_VAL (CTRL1_ODR_200 | CTRL1_BDU | CTRL1_ZEN | CTRL1_YEN | CTRL1_XEN) //0x4F
+#define CTRL3_VAL (CTRL3_FIFO_EN | CTRL3_INT1_FTH)
+#define FIFO_CTRL_VAL (FIFO_MODE_STREAM | ACCEL_FIFO_THRESHOLD) //stream mode keeps the newest 32 samples if we fall behind
+
+#if ACCEL_FIFO_THRESHOLD > ACCEL_BURST_MAX || ACCEL_BURST_MAX > FIFO_DEPTH
+#error "ACCEL_FIFO_THRESHOLD must fit in one burst and ACCEL_BURST_MAX in the sensor FIFO"
+#endif
+#if ACCEL_ODR_HZ != 200
+#error "CTRL1_VAL sets the 200 Hz output data rate"
+#endif
+
+static const uint8_t out_reg = OUT_X_L;
+static const uint8_t fifo_src_reg = FIFO_SRC;
+
+static int16_t burst[ACCEL_BURST_MAX][3]; //1g = 16384
+static volatile uint8_t burst_count = 0; //samples in burst, written by the i2c callback
+static uint8_t burst_pos = 0; //next sample to hand out
+static uint8_t fifo_src = 0;
+
+static void burst_done(i2c_txn_t* txn);
+
+//with FIFO_EN set the sensor's register pointer wraps from OUT_Z_H back to OUT_X_L,
+//so a single auto-increment read of 6*n bytes returns n consecutive samples
+static i2c_txn_t burst_txn = {
+    LIS2HH12_ADDR, &out_reg, 1, (uint8_t*)burst, 6, burst_done, I2C_IDLE
+};
+
+#if ACCEL_FIFO
+static void fifo_src_done(i2c_txn_t* txn);
+
+static i2c_txn_t fifo_src_txn = {
+    LIS2HH12_ADDR, &fifo_src_reg, 1, &fifo_src, 1, fifo_src_done, I2C_IDLE
+};
+
+static void fifo_src_done(i2c_txn_t* txn) { //runs in the TWI interrupt
+    if (txn->status != I2C_DONE) {
+        spsc_push(&events, EVENT_ACCEL_NACK);
+        txn->status = I2C_IDLE;
+        return;
+    }
+
+    uint8_t n = fifo_src & FIFO_SRC_FSS_MASK;
+    if (fifo_src & FIFO_SRC_OVR) {
+        spsc_push(&events, EVENT_ACCEL_OVERRUN);
+        n = ACCEL_BURST_MAX; //full, FSS alone doesn't say how many
+    }
+    if (n > ACCEL_BURST_MAX) n = ACCEL_BURST_MAX;
+
+    txn->status = I2C_IDLE;
+    if (n == 0 || (fifo_src & FIFO_SRC_EMPTY)) return;
+
+    burst_txn.rx_len = n*6;
+    i2c_submit(&burst_txn); //chained directly so the data follows the status read with no main loop round trip
+}
+#endif
+
+static void burst_done(i2c_txn_t* txn) { //runs in the TWI interrupt
+    if (txn->status == I2C_DONE) {
+        burst_pos = 0;
+        burst_count = txn->rx_len/6;
+    } else {
+        spsc_push(&events, EVENT_ACCEL_NACK);
+    }
+    txn->status = I2C_IDLE;
+}
+
+static uint8_t write_reg(uint8_t reg, uint8_t value) {
+    uint8_t packet[2] = {reg, value};
+    return i2c_send(&packet[0], 2);
+}
+
+uint8_t accel_init(void) {
+    uint8_t id = 0;
+    if (!i2c_read_reg(WHO_AM_I, &id, 1) || id != WHO_AM_I_ID) return 0; //missing, still booting or something else on the address
+
+    //FIFO_CTRL and CTRL3 first, so the data rate set in CTRL1 starts a clean stream
+#if ACCEL_FIFO
+    if (!write_reg(FIFO_CTRL, FIFO_CTRL_VAL) || !write_reg(CTRL3, CTRL3_VAL)) return 0;
+#endif
+    uint8_t ctrl1 = 0;
+    if (!write_reg(CTRL1, CTRL1_VAL) || !i2c_read_reg(CTRL1, &ctrl1, 1) || ctrl1 != CTRL1_VAL) return 0;
+
+    burst_pos = 0;
+    burst_count = 0; //drop anything left from before a restart
+
+#ifdef ACCEL_INT_PORT
+    DDRx(ACCEL_INT_PORT) &= ~ACCEL_INT_PIN;
+#endif
+    return 1;
+}
+
+void accel_poll(void) {
+    if (burst_count != 0) return; //main hasn't drained the last burst yet
+
+#if ACCEL_FIFO
+#ifdef ACCEL_INT_PORT
+    if (!READ_PIN(ACCEL_INT_PORT, ACCEL_INT_PIN)) return; //below threshold, nothing worth a transfer
+#endif
+    if (fifo_src_txn.status != I2C_IDLE || burst_txn.status != I2C_IDLE) return;
+    i2c_submit(&fifo_src_txn);
+#else
+    if (burst_txn.status != I2C_IDLE) return;
+    burst_txn.rx_len = 6;
+    i2c_submit(&burst_txn);
+#endif
+}
+
+uint8_t accel_read(volatile int16_t* xyz) {
+    uint8_t n = burst_count; //no transfer can be in flight while this is nonzero
+    if (n == 0) return 0;
+    if (burst_pos >= n) {
+        burst_count = 0; //lets accel_poll start the next transfer
+        return 0;
+    }
+
+    xyz[0] = burst[burst_pos][0];
+    xyz[1] = burst[burst_pos][1];
+    xyz[2] = burst[burst_pos][2];
+    burst_pos++;
+    return 1;
+}
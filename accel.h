@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+#include "pins.h" //ACCEL_INT_PORT, if wired
+#include "sched.h"
+
+#define ACCEL_ODR_HZ 200 //sensor output data rate, CTRL1_ODR_200 in accel.c
+#define ACCEL_FIFO 1 //1: sensor buffers samples in its FIFO and they are drained in bursts, 0: read the latest sample on every poll
+#define ACCEL_FIFO_THRESHOLD 4 //samples; FIFO_SRC_FTH (and INT1 if wired) asserts at this level
+#define ACCEL_BURST_MAX 8 //max samples moved per burst read (6 bytes each)
+
+//display timer ticks between accel_poll() calls, the FIFO holds the samples in between. with INT1 wired every
+//tick is checked against the pin for free; without it each poll costs a FIFO_SRC read, so poll about as often
+//as the FIFO reaches its threshold (20 ms at 200 Hz) and take whatever has arrived
+#if ACCEL_FIFO && defined(ACCEL_INT_PORT)
+#define ACCEL_POLL_TICKS 0
+#elif ACCEL_FIFO
+#define ACCEL_POLL_TICKS (SCHED_MS(ACCEL_FIFO_THRESHOLD*1000UL/ACCEL_ODR_HZ) - 1)
+#else
+#define ACCEL_POLL_TICKS 5
+#endif
+
+#define ACCEL_BOOT_MS 50 //the sensor may take this long after power up to answer, accel_init() is retried until then
+#define ACCEL_STALL_MS 50 //no samples for this long and the sensor is set up again
+
+uint8_t accel_init(void); //blocking (a few ms at most), call after i2c_init() and sei(); checks WHO_AM_I and the settings, returns 0 on failure
+void accel_poll(void); //start the next background read if the previous burst has been consumed
+uint8_t accel_read(volatile int16_t* xyz); //copy the next unread sample into xyz, returns 0 when there are none left
@@ -0,0 +1,89 @@
+#include "adc.h"
+#include "shared.h"
+#include "perf.h"
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <stdint.h>
+
+#define ADC_MUX_BATTERY ((1 << MUX1) | (1 << MUX0)) //ADC3
+#define ADC_MUX_TEMPERATURE (1 << MUX3) //ADC8
+
+//a sum of 1024*ADC_OVERSAMPLE would be ADC_VREF_MV at the pin, so mV = sum*scale >> 16 with one 16x16 multiply
+//(for 64 samples the scale is exactly ADC_VREF_MV*ADC_BATTERY_DIVIDER)
+#define ADC_MV_SCALE (ADC_VREF_MV*ADC_BATTERY_DIVIDER*65536UL/(1024UL*ADC_OVERSAMPLE))
+
+#if ADC_OVERSAMPLE > 64
+#error "ADC_OVERSAMPLE sums would overflow 16 bits"
+#endif
+
+#if ADC_MV_SCALE > 65535
+#error "ADC_OVERSAMPLE too small for the battery scale to fit in 16 bits"
+#endif
+
+//the largest prescaler keeps the interrupt rate down, F_CPU/128 must be in the 50-200 kHz full resolution range
+#define ADC_PRESCALER 128
+#if F_CPU/ADC_PRESCALER < 50000 || F_CPU/ADC_PRESCALER > 200000
+#error "no ADC clock in the full resolution range at this F_CPU"
+#endif
+
+static const uint8_t mux[ADC_CHANNELS] = {ADC_MUX_BATTERY, ADC_MUX_TEMPERATURE};
+
+static uint8_t channel = 0;
+static uint8_t count = 0;
+static uint16_t acc = 0;
+
+static volatile uint16_t sums[ADC_CHANNELS];
+static volatile uint16_t battery_mv = 0;
+static volatile uint8_t adc_seq = 0; //bumped after every published result, see SNAPSHOT_READ
+
+static inline void adc_sample(void) {
+    uint16_t sample = ADC; //low byte first, as the data registers require
+
+    //in free-running mode the next conversion already started on the old channel when this runs,
+    //so the first sample after a channel switch is thrown away (count starts at -1)
+    if (count++ == 0xFF) return;
+    acc += sample;
+    if (count < ADC_OVERSAMPLE) return;
+
+    sums[channel] = acc;
+    if (channel == ADC_BATTERY) {
+        uint16_t mv = ((uint32_t)acc*(uint16_t)ADC_MV_SCALE) >> 16;
+        if (battery_mv == 0) battery_mv = mv; //first result, nothing to filter against yet
+        else battery_mv += ((int16_t)(mv - battery_mv)) >> ADC_FILTER_SHIFT;
+    }
+    adc_seq++;
+
+    acc = 0;
+    count = 0xFF;
+    if (++channel == ADC_CHANNELS) channel = 0;
+    ADMUX = (1 << REFS1) | (1 << REFS0) | mux[channel];
+}
+
+ISR(ADC_vect) {
+    PERF_ISR_BEGIN();
+    adc_sample();
+    PERF_ISR_END(PERF_ISR_ADC);
+}
+
+void adc_init(void) {
+    PRR0 &= ~(1 << PRADC); //disable ADC power reduction
+    DIDR0 = (1 << ADC3D); //analog input, the digital buffer would only waste power
+    ADMUX = (1 << REFS1) | (1 << REFS0) | mux[0]; //1.1V reference, right adjusted 10-bit results
+    ADCSRB = 0; //auto trigger source: free running
+    count = 0xFF;
+    //ADC clock F_CPU/128 (62.5 kHz at 8 MHz, 156 kHz at 20 MHz), 13 clocks per conversion
+    //so about 4800 conversions/s at 8 MHz
+    ADCSRA = (1 << ADEN) | (1 << ADSC) | (1 << ADATE) | (1 << ADIE) | (1 << ADPS2) | (1 << ADPS1) | (1 << ADPS0);
+}
+
+uint16_t adc_battery_mv(void) {
+    uint16_t mv;
+    SNAPSHOT_READ(adc_seq, mv, battery_mv);
+    return mv;
+}
+
+uint16_t adc_sum(uint8_t ch) {
+    uint16_t sum;
+    SNAPSHOT_READ(adc_seq, sum, sums[ch]);
+    return sum;
+}
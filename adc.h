@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdint.h>
+
+//the ADC free-runs in the background: every conversion lands in ADC_vect, ADC_OVERSAMPLE of them are summed
+//per channel (3 extra bits of resolution), then the channel list moves on
+#define ADC_OVERSAMPLE 64 //samples summed per result, 64 x 10 bits just fits in 16
+#define ADC_VREF_MV 1100 //internal bandgap reference
+#define ADC_BATTERY_DIVIDER 13 //battery voltage divider ratio on ADC3
+#define ADC_FILTER_SHIFT 2 //battery IIR low-pass, each result moves the filtered value 1/4 of the way
+
+//channel list, in conversion order
+#define ADC_BATTERY 0 //ADC3 (PC3), battery through the divider
+#define ADC_TEMPERATURE 1 //internal temperature sensor, about 1 mV/C, uncalibrated
+#define ADC_CHANNELS 2
+
+void adc_init(void); //start free-running conversions, results begin arriving about 14 ms after sei() (at 8 MHz, less above)
+uint16_t adc_battery_mv(void); //latest filtered battery voltage, never blocks
+uint16_t adc_sum(uint8_t channel); //latest raw sum of ADC_OVERSAMPLE conversions (0 to 65472)
@@ -0,0 +1,128 @@
+#include "blackbox.h"
+#include "rx.h"
+#include "motor.h"
+#include "control.h"
+#include "sd.h"
+#include "tables.h"
+#include <avr/pgmspace.h>
+#include <stdint.h>
+#include <string.h>
+
+_Static_assert(sizeof(blackbox_t) <= SD_BLOCK_SIZE, "a black box dump must fit in one SD block");
+
+blackbox_t blackbox __attribute__((section(".noinit"))); //not cleared at startup, so it outlives a watchdog or brown-out reset
+
+static uint8_t last[BLACKBOX_FIELDS]; //the previous sample as a decoder rebuilds it from the step codes
+static uint8_t divider = 0;
+static int8_t last_side = 0; //last nonzero orientation_filtered, 0 until the first sample so booting upside down isn't a flip
+static uint8_t last_faults = 0xFF; //channels start out faulted, only one that has been fine can fail
+
+static void clear(void) {
+    blackbox.event = 0;
+    blackbox.post = 0;
+    blackbox.head = 0;
+    blackbox.pos = 0;
+    blackbox.blocks = 0;
+    blackbox.magic = BLACKBOX_MAGIC;
+}
+
+static void trigger(uint8_t event) {
+    if (blackbox.event || !(BLACKBOX_TRIGGERS & (1 << event))) return; //the first event wins until the record is dumped
+    blackbox.event = event;
+    blackbox.post = BLACKBOX_POST_BLOCKS;
+}
+
+uint8_t blackbox_frozen(void) {
+    return blackbox.event && !blackbox.post;
+}
+
+void blackbox_init(uint8_t event, uint8_t slot) {
+    if (event == BLACKBOX_COLD || blackbox.magic != BLACKBOX_MAGIC || blackbox.head >= BLACKBOX_BLOCKS
+            || blackbox.pos >= BLACKBOX_SAMPLES_PER_BLOCK || blackbox.blocks >= BLACKBOX_BLOCKS) {
+        blackbox.slot = slot;
+        clear();
+    } else if (blackbox.event) {
+        blackbox.post = 0; //frozen already, or the reset cut the recording after the event short
+    } else if (event && (BLACKBOX_TRIGGERS & (1 << event))) {
+        blackbox.event = event; //what led up to the reset, as it was
+    } else {
+        clear();
+    }
+    if (blackbox.slot >= BLACKBOX_SLOTS) blackbox.slot = 0;
+}
+
+static inline int8_t clip_s8(int16_t value) {
+    if (value > 127) return 127;
+    if (value < -128) return -128;
+    return value;
+}
+
+static inline uint8_t step_code(uint8_t i, uint8_t value) { //4-bit code for the change in field i, and track what it decodes to
+    uint8_t code = pgm_read_byte(&blackbox_code[(uint8_t)(value - last[i])]);
+    last[i] += pgm_read_byte(&blackbox_step[code]);
+    return code;
+}
+
+void blackbox_sample(uint16_t voltage_mv) {
+    //triggers are checked on every sample, recording runs at 1/BLACKBOX_DIVIDER of the rate
+    int8_t side = orientation_filtered;
+    if (side && side != last_side) {
+        if (last_side) trigger(BLACKBOX_FLIP);
+        last_side = side;
+    }
+    uint8_t faults = rx_faults;
+    if (faults & ~last_faults) trigger(BLACKBOX_FAILSAFE);
+    last_faults = faults;
+
+    if (++divider < BLACKBOX_DIVIDER || blackbox_frozen()) return;
+    divider = 0;
+
+    uint8_t s[BLACKBOX_FIELDS] = {
+        pulse_duty_cycle_brushed[0], pulse_duty_cycle_brushed[1], pulse_duty_cycle_brushed[2], pulse_duty_cycle_brushed[3],
+        brushless_power_in,
+        xyz[0] >> 8, xyz[1] >> 8, xyz[2] >> 8, //64 = 1g
+        orientation_filtered,
+        brushed_1_power >> 1, brushed_2_power >> 1, clip_s8(brushless_power),
+        faults,
+        voltage_mv >> 7 //128 mV
+    };
+
+    uint8_t* b = blackbox.block[blackbox.head];
+    uint8_t pos = blackbox.pos;
+    if (pos == 0) { //raw sample so the block decodes on its own
+        b[0] = blackbox.seq;
+        memcpy(&b[1], s, BLACKBOX_FIELDS);
+        memcpy(last, s, BLACKBOX_FIELDS);
+    } else {
+        uint8_t* d = &b[1 + BLACKBOX_FIELDS + (pos - 1)*(BLACKBOX_FIELDS/2)];
+        for (uint8_t i = 0; i < BLACKBOX_FIELDS; i += 2) {
+            uint8_t lo = step_code(i, s[i]);
+            *d++ = lo | (step_code(i + 1, s[i + 1]) << 4);
+        }
+    }
+
+    //the sample is in place before it is counted, a reset in between only loses this sample
+    if (++pos < BLACKBOX_SAMPLES_PER_BLOCK) {
+        blackbox.pos = pos;
+        return;
+    }
+    blackbox.pos = 0;
+    blackbox.seq++;
+    if (blackbox.blocks < BLACKBOX_BLOCKS - 1) blackbox.blocks++;
+    blackbox.head = (blackbox.head + 1 < BLACKBOX_BLOCKS) ? blackbox.head + 1 : 0;
+    if (blackbox.post) blackbox.post--;
+}
+
+uint8_t blackbox_dump(void) {
+    if (!blackbox_frozen() || !sd_start(SD_BLACKBOX_FIRST_BLOCK + blackbox.slot)) return 0;
+
+    const uint8_t* p = (const uint8_t*)&blackbox;
+    for (uint16_t n = 0; n < sizeof(blackbox); n += 128) {
+        sd_log(p + n, (sizeof(blackbox) - n < 128) ? sizeof(blackbox) - n : 128); //a fresh stream has room for a whole block
+    }
+    sd_stop();
+
+    blackbox.slot = (blackbox.slot + 1 < BLACKBOX_SLOTS) ? blackbox.slot + 1 : 0;
+    clear();
+    return 1;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+
+//black box: the last second or so of inputs, orientation and outputs, kept in RAM that survives a reset.
+//every sample is 14 fields quantised to a byte; each block starts with one raw sample followed by
+//4-bit step codes per field (see blackbox_step in tables.h), so a block can be decoded on its own.
+//an event freezes the ring after BLACKBOX_POST_BLOCKS more blocks, a watchdog or brown-out reset freezes it
+//as it was; sd_task() then writes it to the card (blackbox.py decodes it) and recording starts over
+#define BLACKBOX_BLOCKS 4
+#define BLACKBOX_BLOCK_SIZE 64 //sequence byte, raw sample, 7 step-coded samples
+#define BLACKBOX_FIELDS 14
+#define BLACKBOX_SAMPLES_PER_BLOCK (1 + (BLACKBOX_BLOCK_SIZE - 1 - BLACKBOX_FIELDS)/(BLACKBOX_FIELDS/2))
+#define BLACKBOX_DIVIDER 8 //record every Nth accelerometer sample, 25 Hz
+#define BLACKBOX_POST_BLOCKS 1 //blocks recorded after an event before the ring freezes
+#define BLACKBOX_SLOTS 64 //dumps go to SD_BLACKBOX_FIRST_BLOCK + slot in turn, wrapping; the slot is kept in EEPROM (calib_sd)
+#define BLACKBOX_MAGIC 0xB10C
+
+//events, also the cause stored with a frozen record
+#define BLACKBOX_COLD 0xFF //blackbox_init(): power up, RAM contents are meaningless
+#define BLACKBOX_FLIP 1 //orientation_filtered changed sides
+#define BLACKBOX_FAILSAFE 2 //a receiver channel that was fine faulted
+#define BLACKBOX_BROWN_OUT 3
+#define BLACKBOX_WATCHDOG 4
+#define BLACKBOX_TRIGGERS ((1 << BLACKBOX_FLIP) | (1 << BLACKBOX_FAILSAFE) | (1 << BLACKBOX_BROWN_OUT) | (1 << BLACKBOX_WATCHDOG))
+
+#if BLACKBOX_SAMPLES_PER_BLOCK != 8 || BLACKBOX_FIELDS % 2
+#error "blackbox.py assumes 64-byte blocks of 8 samples"
+#endif
+
+typedef struct { //in .noinit, and the image written to the card
+    uint16_t magic; //BLACKBOX_MAGIC while the rest is valid
+    uint8_t event; //what froze the ring, 0 while recording
+    uint8_t post; //blocks still to record after the event
+    uint8_t head; //block being written
+    uint8_t pos; //samples in it
+    uint8_t blocks; //complete blocks before head, up to BLACKBOX_BLOCKS - 1
+    uint8_t seq; //block counter, the first byte of every block
+    uint8_t slot; //SD slot of the next dump
+    uint8_t block[BLACKBOX_BLOCKS][BLACKBOX_BLOCK_SIZE];
+} blackbox_t;
+
+extern blackbox_t blackbox;
+
+//after a reset: BLACKBOX_WATCHDOG / BLACKBOX_BROWN_OUT freeze what led up to it, BLACKBOX_COLD clears, 0 keeps a frozen record.
+//slot: where dumps continue when RAM has nothing valid
+void blackbox_init(uint8_t event, uint8_t slot);
+void blackbox_sample(uint16_t voltage_mv); //call after control_sample(): checks the triggers and records every BLACKBOX_DIVIDER'th call
+uint8_t blackbox_frozen(void);
+uint8_t blackbox_dump(void); //with the SD driver ready: write a frozen record to its slot and re-arm, returns 1 if a dump stream was opened
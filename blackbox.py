@@ -0,0 +1,96 @@
+#!/usr/bin/env python3
+import argparse
+import struct
+import sys
+
+from tablegen import blackbox_steps
+
+# Decodes black box dumps (blackbox.h) into CSV, one row per sample, oldest first.
+# The dumps are one SD block each starting at SD_BLACKBOX_FIRST_BLOCK, e.g. on Linux:
+#   dd if=/dev/sdX of=blackbox.bin bs=512 skip=1024 count=64
+#   python blackbox.py blackbox.bin
+# Blocks without the magic number (unused slots) are skipped.
+
+BLOCKS = 4
+BLOCK_SIZE = 64
+SAMPLES_PER_BLOCK = 8
+HEADER = struct.Struct("<HBBBBBBB") # magic, event, post, head, pos, blocks, seq, slot
+MAGIC = 0xB10C
+SAMPLE_MS = 40 # BLACKBOX_DIVIDER samples at 200 Hz
+
+EVENTS = {1: "flip", 2: "failsafe", 3: "brown-out", 4: "watchdog"}
+
+# name, signed, scale to the firmware's units
+FIELDS = [
+    ("duty_1a", False, 1), ("duty_1b", False, 1), ("duty_2a", False, 1), ("duty_2b", False, 1),
+    ("brushless_in", False, 1),
+    ("x", True, 256), ("y", True, 256), ("z", True, 256),
+    ("orientation", True, 1),
+    ("brushed_1", True, 2), ("brushed_2", True, 2), ("brushless", True, 1),
+    ("rx_faults", False, 1),
+    ("voltage_mv", False, 128),
+]
+
+def block_samples(block, count):
+    # a raw sample, then step codes two fields per byte (low nibble first)
+    if count == 0:
+        return []
+    steps = blackbox_steps()
+    n = len(FIELDS)
+    value = list(block[1:1 + n])
+    out = [list(value)]
+    for s in range(1, count):
+        codes = block[1 + n + (s - 1)*(n//2):1 + n + s*(n//2)]
+        for i in range(n):
+            c = (codes[i//2] >> (4*(i & 1))) & 0xF
+            value[i] = (value[i] + steps[c]) & 0xFF
+        out.append(list(value))
+    return out
+
+def scaled(raw):
+    out = []
+    for v, (_, signed, scale) in zip(raw, FIELDS):
+        if signed and v >= 128:
+            v -= 256
+        out.append(v*scale)
+    return out
+
+def decode(image, slot_block, w):
+    magic, event, post, head, pos, blocks, seq, slot = HEADER.unpack_from(image)
+    if magic != MAGIC or head >= BLOCKS or pos >= SAMPLES_PER_BLOCK or blocks >= BLOCKS:
+        return False
+    ring = image[HEADER.size:HEADER.size + BLOCKS*BLOCK_SIZE]
+    samples = []
+    for k in range(blocks, -1, -1): # oldest complete block first, the one being written last
+        b = (head - k) % BLOCKS
+        block = ring[b*BLOCK_SIZE:(b + 1)*BLOCK_SIZE]
+        samples += block_samples(block, SAMPLES_PER_BLOCK if k else pos)
+    end = len(samples) - 1
+    for i, s in enumerate(samples):
+        w.write("%d,%s,%d,%s\n" % (slot_block, EVENTS.get(event, str(event)), (i - end)*SAMPLE_MS,
+                                   ",".join(str(v) for v in scaled(s))))
+    return True
+
+def main():
+    p = argparse.ArgumentParser()
+    p.add_argument("image", help="raw blocks read from the card, starting at a dump slot")
+    p.add_argument("--first-block", type=int, default=1024,
+                   help="card block the image starts at (SD_BLACKBOX_FIRST_BLOCK), for the block column")
+    args = p.parse_args()
+
+    with open(args.image, "rb") as f:
+        data = f.read()
+
+    w = sys.stdout
+    w.write("block,event,ms," + ",".join(name for name, _, _ in FIELDS) + "\n")
+    found = 0
+    for i in range(0, len(data) - 511, 512):
+        if decode(data[i:i + 512], args.first_block + i//512, w):
+            found += 1
+    if not found:
+        sys.stderr.write("no black box dumps found\n")
+        return 1
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,197 @@
+#include "calib.h"
+#include "rx.h"
+#include "control.h"
+#include "sd.h"
+#include <avr/eeprom.h>
+#include <avr/pgmspace.h>
+#include <util/crc16.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define ACCEL_1G 16384 //xyz counts per g
+
+static calib_t EEMEM calib_eeprom;
+static calib_sd_t EEMEM calib_sd_eeprom[2];
+
+static const calib_t PROGMEM calib_defaults = {
+    CALIB_VERSION,
+    {0, 0, 0, 0, RX_BRUSHLESS_MIN_US},
+    {0, 0, 0, 0, RX_BRUSHLESS_CENTER_US},
+    {255, 255, 255, 255, RX_BRUSHLESS_MAX_US},
+    ORIENT_DOWN,
+    ORIENT_DEADZONE,
+    ORIENT_CONFIDENT,
+    0
+};
+
+calib_t calib;
+uint8_t calib_stored = 0;
+uint8_t calib_active = 0;
+uint8_t calib_learned = 0;
+calib_sd_t calib_sd = {SD_LOG_FIRST_BLOCK, 0, 0, 0};
+
+static uint16_t seen_min[RX_CHANNELS]; //readings while calibrating
+static uint16_t seen_max[RX_CHANNELS];
+static int32_t down_sum[3]; //gravity IIR, 2^CALIB_DOWN_SHIFT times the average
+static uint8_t write_pos = sizeof(calib_t); //next byte calib_poll() writes to EEPROM, sizeof(calib_t) when idle
+static calib_sd_t sd_out; //calib_sd as it is being written, so a save during the write can't tear it
+static uint8_t sd_write_pos = sizeof(calib_sd_t);
+static uint8_t sd_pending = 0;
+
+static uint16_t crc_of(const void* record, uint8_t len) {
+    const uint8_t* p = record;
+    uint16_t crc = 0xFFFF;
+    for (uint8_t i = 0; i < len; i++) crc = _crc16_update(crc, p[i]);
+    return crc;
+}
+
+static uint16_t record_crc(const calib_t* c) {
+    return crc_of(c, offsetof(calib_t, crc));
+}
+
+static uint8_t sd_valid(const calib_sd_t* c) {
+    return c->crc == crc_of(c, offsetof(calib_sd_t, crc));
+}
+
+static void sd_load(void) {
+    calib_sd_t copy[2];
+    eeprom_read_block(copy, calib_sd_eeprom, sizeof(copy));
+    uint8_t a = sd_valid(&copy[0]), b = sd_valid(&copy[1]);
+    if (a && (!b || (int8_t)(copy[0].seq - copy[1].seq) > 0)) calib_sd = copy[0];
+    else if (b) calib_sd = copy[1];
+}
+
+static inline uint16_t min_span(uint8_t ch) {
+    return (ch == RX_BRUSHLESS) ? CALIB_MIN_SPAN_US : CALIB_MIN_SPAN_DUTY;
+}
+
+//everything the hot paths need is worked out here, so they only multiply and shift
+static void apply(void) {
+    for (uint8_t ch = 0; ch < RX_CHANNELS; ch++) {
+        uint16_t span = calib.max[ch] - calib.center[ch];
+        rx_range[ch].zero = calib.center[ch];
+        rx_range[ch].span = span;
+        rx_range[ch].scale = RX_SCALE(span);
+    }
+
+    //the receiver's failsafe pulse usually sits just outside the transmitter's range
+    uint16_t lo = calib.min[RX_BRUSHLESS] - RX_BRUSHLESS_MARGIN_US;
+    uint16_t hi = calib.max[RX_BRUSHLESS] + RX_BRUSHLESS_MARGIN_US;
+    rx_width_min = (lo > RX_BRUSHLESS_VALID_US) ? lo : RX_BRUSHLESS_VALID_US;
+    rx_width_max = (hi < RX_BRUSHLESS_PULSE_MAX_US) ? hi : RX_BRUSHLESS_PULSE_MAX_US;
+
+    xyz_down[0] = calib.down[0];
+    xyz_down[1] = calib.down[1];
+    xyz_down[2] = calib.down[2];
+    orient_deadzone = calib.deadzone;
+    orient_confident = calib.confident;
+}
+
+void calib_load(void) {
+    eeprom_read_block(&calib, &calib_eeprom, sizeof(calib));
+    calib_stored = calib.version == CALIB_VERSION && calib.crc == record_crc(&calib);
+    if (!calib_stored) memcpy_P(&calib, &calib_defaults, sizeof(calib)); //blank, old or half written
+    apply();
+    sd_load();
+}
+
+void calib_sd_save(void) {
+    sd_pending = 1;
+}
+
+void calib_start(void) {
+    control_disarmed = 1;
+    calib_active = 1;
+    calib_learned = 0;
+
+    //accept any sane brushless pulse while learning, a new transmitter may reach past the old window
+    rx_width_min = RX_BRUSHLESS_VALID_US;
+    rx_width_max = RX_BRUSHLESS_PULSE_MAX_US;
+
+    for (uint8_t ch = 0; ch < RX_CHANNELS; ch++) {
+        seen_min[ch] = 0xFFFF;
+        seen_max[ch] = 0;
+    }
+    for (uint8_t i = 0; i < 3; i++) down_sum[i] = (int32_t)xyz[i] << CALIB_DOWN_SHIFT;
+}
+
+void calib_sample(void) {
+    for (uint8_t i = 0; i < 3; i++) down_sum[i] += xyz[i] - (down_sum[i] >> CALIB_DOWN_SHIFT);
+}
+
+static uint16_t isqrt(uint32_t x) { //floor(sqrt(x)), one result bit per iteration
+    uint32_t root = 0;
+    uint32_t bit = 1UL << 30;
+    while (bit > x) bit >>= 2;
+    while (bit) {
+        if (x >= root + bit) {
+            x -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return root;
+}
+
+void calib_finish(void) {
+    //a channel is only replaced if it moved far enough and rests far enough below its max,
+    //so a stick that was missed or a receiver that was off keeps its old range
+    for (uint8_t ch = 0; ch < RX_CHANNELS; ch++) {
+        uint8_t bit = 1 << ch;
+        uint16_t center = rx_raw[ch];
+        if ((calib_learned & bit) && !(rx_faults & bit) && center >= seen_min[ch]
+                && center < seen_max[ch] && seen_max[ch] - center >= min_span(ch)) {
+            calib.min[ch] = seen_min[ch];
+            calib.center[ch] = center;
+            calib.max[ch] = seen_max[ch];
+        }
+    }
+
+    //resting gravity becomes the Q7 down vector, unless the robot was moving or the sensor isn't reporting
+    int16_t g[3];
+    for (uint8_t i = 0; i < 3; i++) g[i] = down_sum[i] >> CALIB_DOWN_SHIFT;
+    uint16_t mag = isqrt((int32_t)g[0]*g[0] + (int32_t)g[1]*g[1] + (int32_t)g[2]*g[2]);
+    if (mag > ACCEL_1G*3/4 && mag < ACCEL_1G*5/4) {
+        for (uint8_t i = 0; i < 3; i++) calib.down[i] = (int8_t)(((int32_t)g[i]*127)/mag);
+    }
+
+    calib.version = CALIB_VERSION;
+    calib.crc = record_crc(&calib);
+    calib_stored = 1;
+    apply();
+    write_pos = 0; //calib_poll() writes the record out, about 3.4 ms per byte
+
+    calib_active = 0;
+    control_disarmed = 0;
+}
+
+void calib_poll(void) {
+    if (calib_active) {
+        for (uint8_t ch = 0; ch < RX_CHANNELS; ch++) {
+            uint8_t bit = 1 << ch;
+            if (rx_faults & bit) continue; //rx_raw only moves while the channel is healthy
+            uint16_t r = rx_raw[ch];
+            if (r < seen_min[ch]) seen_min[ch] = r;
+            if (r > seen_max[ch]) seen_max[ch] = r;
+            if (seen_max[ch] - seen_min[ch] >= min_span(ch)) calib_learned |= bit;
+        }
+    }
+
+    //one byte per call, only when the previous one has finished; unchanged bytes aren't rewritten
+    if (!eeprom_is_ready()) return;
+    if (write_pos < sizeof(calib_t)) {
+        eeprom_update_byte((uint8_t*)&calib_eeprom + write_pos, ((const uint8_t*)&calib)[write_pos]);
+        write_pos++;
+    } else if (sd_write_pos < sizeof(calib_sd_t)) {
+        eeprom_update_byte((uint8_t*)&calib_sd_eeprom[sd_out.seq & 1] + sd_write_pos, ((const uint8_t*)&sd_out)[sd_write_pos]);
+        sd_write_pos++;
+    } else if (sd_pending) { //into the copy that isn't current
+        sd_pending = 0;
+        sd_out = calib_sd;
+        sd_out.seq = ++calib_sd.seq;
+        sd_out.crc = crc_of(&sd_out, offsetof(calib_sd_t, crc));
+        sd_write_pos = 0;
+    }
+}
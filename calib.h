@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+#include "rx.h"
+
+//calibration: a long press on the button disarms the motors and starts learning. move every stick through
+//its full range, then leave the sticks at rest with the robot sitting right side up and press the button again.
+//the ranges, the resting gravity vector and the tuning below are written to EEPROM with a CRC and loaded
+//at boot; a missing or corrupt record falls back to the defaults in rx.h and control.h
+#define CALIB_HOLD_MS 2000 //button held this long starts a calibration
+#define CALIB_VERSION 1 //bump when calib_t changes, a record with another version is ignored
+#define CALIB_MIN_SPAN_DUTY 64 //a brushed channel must move this far (duty 0-255) between min and max, and above its center
+#define CALIB_MIN_SPAN_US 300 //same for the brushless channel, pulse width
+#define CALIB_DOWN_SHIFT 5 //resting gravity is averaged over about 2^5 accelerometer samples
+
+typedef struct { //EEPROM record
+    uint8_t version;
+    uint16_t min[RX_CHANNELS]; //brushed: duty 0-255, brushless: us; only the brushless failsafe window uses min
+    uint16_t center[RX_CHANNELS]; //reading with the sticks at rest, 0 power
+    uint16_t max[RX_CHANNELS]; //full power
+    int8_t down[3]; //xyz_down
+    int16_t deadzone; //orient_deadzone
+    uint8_t confident; //orient_confident
+    uint16_t crc; //CRC-16 of everything above
+} calib_t;
+
+//where the SD log and the black box dumps continue after a reboot. kept in two copies written in turn, so a
+//reset in the middle of a write leaves the other one; the copy with the later seq wins
+typedef struct { //EEPROM record
+    uint32_t log_block; //the next boot's log stream starts here, ahead of anything written so far
+    uint8_t blackbox_slot; //slot of the next black box dump
+    uint8_t seq;
+    uint16_t crc; //CRC-16 of everything above
+} calib_sd_t;
+
+extern calib_t calib; //values in use
+extern uint8_t calib_stored; //1: calib came from EEPROM, 0: defaults
+extern uint8_t calib_active; //1: calibrating, motors disarmed
+extern uint8_t calib_learned; //while calibrating, bit per channel that has moved far enough to be learned
+extern calib_sd_t calib_sd; //SD positions in use, SD_LOG_FIRST_BLOCK / slot 0 if neither copy is valid
+
+void calib_load(void); //read the EEPROM records and set up rx_range, xyz_down and the tuning; call before rx_init()
+void calib_start(void);
+void calib_sample(void); //call with every accelerometer sample while calib_active
+void calib_finish(void); //keep what was learned, write it to EEPROM in the background and re-arm
+void calib_sd_save(void); //after changing calib_sd: queue it for calib_poll() to write
+void calib_poll(void); //call every few ms: tracks the channel ranges and writes EEPROM a byte at a time, never blocks
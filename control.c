@@ -0,0 +1,175 @@
+#include "control.h"
+#include "rx.h"
+#include "motor.h"
+#include "util.h"
+#include "tables.h"
+#include <avr/pgmspace.h>
+#include <stdint.h>
+
+volatile int16_t xyz[3];
+
+int8_t xyz_down[3] = ORIENT_DOWN;
+int16_t orient_deadzone = ORIENT_DEADZONE;
+uint8_t orient_confident = ORIENT_CONFIDENT;
+volatile uint8_t control_disarmed = 0;
+volatile int16_t orientation_estimate = ORIENT_1G;
+volatile uint8_t orientation_confidence = 0;
+volatile int8_t downness = 0;
+volatile int8_t orientation_filtered = 1;
+
+volatile int16_t brushed_1_power_in = 0;
+volatile int16_t brushed_2_power_in = 0;
+
+volatile uint8_t traction_ceiling = 255;
+volatile uint16_t traction_cuts = 0;
+volatile uint8_t battery_gain_drive = 128;
+volatile uint8_t battery_gain_weapon = 128;
+static int16_t drive_out[2]; //slewed drive powers, before the orientation flip
+static uint8_t launch = 0; //samples left in the traction window
+static int8_t launch_dir = 0; //direction of the forward demand past TRACTION_ENGAGE, 0 below it
+static int16_t accel_baseline = 0; //DRIVE_AXIS at a steady speed, 64 = 1g, 4 fractional bits
+static int16_t last_forward = 0;
+static uint8_t steady = 0; //samples the drive output hasn't changed, up to the traction window
+
+void control_inputs(void) {
+    brushed_1_power_in = (int16_t)pulse_duty_cycle_brushed[0] - (int16_t)pulse_duty_cycle_brushed[1];
+    brushed_2_power_in = (int16_t)pulse_duty_cycle_brushed[2] - (int16_t)pulse_duty_cycle_brushed[3];
+}
+
+void control_battery(uint16_t mv) {
+    uint16_t i = mv >> 6;
+    if (i > 255) i = 255;
+    battery_gain_drive = pgm_read_byte(&battery_gain[i]);
+    battery_gain_weapon = pgm_read_byte(BATTERY_COMP_WEAPON ? &battery_gain[i] : &battery_limit[i]);
+}
+
+static inline int16_t battery_scale(int16_t power, uint8_t gain) { //255 * 255 still fits 16 bits unsigned
+    uint16_t mag = ((uint16_t)abs_int(power)*gain) >> 7;
+    if (mag > 255) mag = 255;
+    return (power < 0) ? -(int16_t)mag : (int16_t)mag;
+}
+
+static inline void update_orientation(void) {
+    //top byte of each axis times the unit vector: three 8x8 hardware multiplies, no divides.
+    //|projection| <= |xyz|, so the sum can't overflow 16 bits
+    int16_t raw = (int16_t)(int8_t)(xyz[0] >> 8)*xyz_down[0]
+                + (int16_t)(int8_t)(xyz[1] >> 8)*xyz_down[1]
+                + (int16_t)(int8_t)(xyz[2] >> 8)*xyz_down[2];
+
+    int16_t est = orientation_estimate;
+    //raw and est each reach +-22784 at full scale, so a hit against a sustained opposite load can
+    //overflow the difference; saturated it still moves the estimate the right way
+    int32_t diff = (int32_t)raw - est;
+    int16_t error = (diff > 32767) ? 32767 : (diff < -32767) ? -32767 : (int16_t)diff;
+    est += error >> ORIENT_FILTER_SHIFT;
+    orientation_estimate = est;
+    downness = est >> 9;
+
+    //confidence: how far the filtered estimate is from the edge, minus how much the latest sample
+    //disagrees with it (impacts, spinning up). scaled so a steady 1g reads about 254
+    int16_t margin = abs_int(est) - abs_int(error);
+    orientation_confidence = (uint8_t)clip_0(clip_8(margin >> 5));
+
+    if (orientation_confidence >= orient_confident) {
+        orientation_filtered = est > 0 ? 1 : -1; //decisive, flip now
+    } else if (abs_int(est) < orient_deadzone) {
+        orientation_filtered = 0; //on edge
+    }
+}
+
+static int16_t slew(int16_t out, int16_t target) {
+    if (target > out) {
+        int16_t step = (out >= 0) ? DRIVE_SLEW_UP : DRIVE_SLEW_DOWN; //speeding up forward, or braking from reverse
+        out = (target - out > step) ? out + step : target;
+    } else if (target < out) {
+        int16_t step = (out <= 0) ? DRIVE_SLEW_UP : DRIVE_SLEW_DOWN;
+        out = (out - target > step) ? out - step : target;
+    }
+    return out;
+}
+
+static inline void traction(int16_t want, int16_t forward) {
+    //commands are in the robot's frame before the orientation flip, so they keep their sign relative to the
+    //accelerometer whichever side is up
+    int16_t accel = ((int16_t)(int8_t)(xyz[DRIVE_AXIS] >> 8)*DRIVE_AXIS_SIGN) << 4;
+
+    //a launch is the stick going past TRACTION_ENGAGE from rest or from the other direction
+    int8_t dir = (want > TRACTION_ENGAGE) ? 1 : (want < -TRACTION_ENGAGE) ? -1 : 0;
+    if (dir && dir != launch_dir) launch = 1 << TRACTION_WINDOW_SHIFT;
+    launch_dir = dir;
+
+    if (forward != last_forward) steady = 0;
+    else if (steady < 1 << TRACTION_WINDOW_SHIFT) steady++;
+    last_forward = forward;
+
+    uint8_t ceiling = traction_ceiling;
+    if (launch) {
+        launch--;
+        int16_t along = (accel - accel_baseline) >> 4; //in the direction the robot is being driven
+        if (forward < 0) along = -along;
+        int16_t needed = ((uint16_t)launch*launch*TRACTION_MIN_ACCEL) >> (2*TRACTION_WINDOW_SHIFT); //tapers off like the real thing
+        if (abs_int(forward) > TRACTION_ENGAGE && along < needed) {
+            traction_ceiling = (ceiling > TRACTION_FLOOR + TRACTION_BACKOFF) ? ceiling - TRACTION_BACKOFF : TRACTION_FLOOR;
+            traction_cuts++;
+            return;
+        }
+    } else if (steady == 1 << TRACTION_WINDOW_SHIFT) { //no speed change due, whatever is left is gravity
+        accel_baseline += (accel - accel_baseline) >> TRACTION_BASELINE_SHIFT;
+    }
+    traction_ceiling = (ceiling < 255 - TRACTION_BACKOFF/2) ? ceiling + TRACTION_BACKOFF/2 : 255;
+}
+
+static inline void shape_drive(void) {
+    int16_t target[2] = {brushed_1_power_in, brushed_2_power_in};
+    uint8_t faults = rx_faults;
+
+    int16_t ceiling = traction_ceiling;
+    for (uint8_t i = 0; i < 2; i++) {
+        if (target[i] > ceiling) target[i] = ceiling;
+        if (target[i] < -ceiling) target[i] = -ceiling;
+        drive_out[i] = slew(drive_out[i], target[i]);
+    }
+    if (faults & 0x03) drive_out[0] = 0; //a lost receiver cuts at once, not at the slew rate
+    if (faults & 0x0C) drive_out[1] = 0;
+}
+
+void control_sample(void) {
+    update_orientation();
+
+    if (TRACTION_ENABLE && !control_disarmed) {
+        //forward demand (turning in place is 0) against what the drive is putting out
+        traction((brushed_1_power_in + brushed_2_power_in) >> 1, (drive_out[0] + drive_out[1]) >> 1);
+    }
+}
+
+void control_output(void) {
+    if (control_disarmed) {
+        drive_out[0] = drive_out[1] = 0;
+        brushed_1_power = brushed_2_power = brushless_power = 0;
+        set_brushed_duty();
+        set_brushless_duty();
+        return;
+    }
+
+    shape_drive();
+    int8_t side = orientation_filtered;
+    uint8_t gain = battery_gain_drive;
+    brushed_1_power = battery_scale(drive_out[0], gain)*side;
+    brushed_2_power = battery_scale(drive_out[1], gain)*side;
+    set_brushed_duty();
+    int16_t weapon = ((int16_t)brushless_power_in*BRUSHLESS_POWER_LIMIT) >> 8;
+    brushless_power = -battery_scale(weapon, battery_gain_weapon)*side;
+
+    set_brushless_duty();
+
+    //set_digits_signed(orientation_filtered);
+}
+
+void control_accel_lost(void) {
+    orientation_estimate = ORIENT_1G;
+    orientation_confidence = 0;
+    downness = ORIENT_1G >> 9;
+    orientation_filtered = 1;
+    launch = 0; //no samples to judge traction by, so no cut either
+    traction_ceiling = 255;
+}
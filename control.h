@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdint.h>
+
+#define BRUSHLESS_POWER_LIMIT 51 //max weapon power as a fraction of 256 (about 1/5)
+
+//orientation estimate: accelerometer projected onto xyz_down, 1g = ORIENT_1G
+#define ORIENT_1G (64*127) //(raw >> 8) * Q7 unit vector
+#define ORIENT_FILTER_SHIFT 2 //IIR low-pass, each sample moves the estimate 1/4 of the way (about 20 ms at 200 Hz)
+#define ORIENT_DEADZONE (ORIENT_1G/8) //default orient_deadzone
+#define ORIENT_CONFIDENT 128 //default orient_confident
+#define ORIENT_DOWN {0, 102, -76} //default xyz_down
+
+//drive shaping between the receiver and set_brushed_duty(), once per scheduler tick (SCHED_TICK_US)
+#define DRIVE_SLEW_UP 3 //max duty increase away from 0 per tick, 0 to full in 88 ms
+#define DRIVE_SLEW_DOWN 13 //max decrease toward 0 (braking, the first half of a reversal), 0 in 21 ms; 255 = immediate
+#define DRIVE_AXIS 0 //accelerometer axis along the direction of travel, square to ORIENT_DOWN
+#define DRIVE_AXIS_SIGN 1 //-1 if driving forward (both powers > 0) reads negative on DRIVE_AXIS
+
+//traction control: for TRACTION_WINDOW samples after the drive speeds up, the robot should accelerate along
+//DRIVE_AXIS by at least TRACTION_MIN_ACCEL (tapering to 0 over the window as it nears top speed). below that the
+//wheels are taken to be spinning and the duty ceiling drops; pushing matches after the window aren't held back
+#define TRACTION_ENABLE 1
+#define TRACTION_WINDOW_SHIFT 6 //window is 2^6 samples, 320 ms
+#define TRACTION_MIN_ACCEL 12 //64 = 1g (xyz >> 8), at most 15 so the taper fits 16 bits
+#define TRACTION_ENGAGE 96 //forward duty (average of the two sides) above which the check runs
+#define TRACTION_BACKOFF 16 //ceiling drop per sample of spin, it climbs back at half the rate
+#define TRACTION_FLOOR 128 //the ceiling never goes below this
+#define TRACTION_BASELINE_SHIFT 5 //gravity on DRIVE_AXIS (tilt, ramps) is tracked by a slow IIR once the output has held still for a window
+
+//battery compensation: the drive (and with BATTERY_COMP_WEAPON the weapon) is scaled by nominal/measured voltage
+//so a sagging pack drives the same, times a power limit that tapers off below a threshold instead of cutting out.
+//both come from battery_gain/battery_limit in tables.h, set by --battery-* in TABLE_OPTS
+#define BATTERY_COMP_WEAPON 0 //1: the weapon gets the compensation too, 0: only the low-voltage limit
+
+extern volatile uint8_t traction_ceiling; //max drive duty, 255 unless traction control is backing off
+extern volatile uint16_t traction_cuts; //samples the ceiling was lowered, since boot
+extern volatile uint8_t battery_gain_drive; //128 = 1, see control_battery()
+extern volatile uint8_t battery_gain_weapon;
+
+//tuning, loaded from EEPROM by calib_load()
+extern int8_t xyz_down[3]; //unit vector indicating which way is down when right side up, 127 = 1
+extern int16_t orient_deadzone; //filtered estimate closer to 0 than this means the robot is on its edge, drive power is set to 0
+extern uint8_t orient_confident; //confidence (0-255, 255 = a steady 1g) needed to flip the drive direction
+extern volatile uint8_t control_disarmed; //1: every motor output is held at 0 (while calibrating)
+
+extern volatile int16_t xyz[3]; //1g = 16384, latest accelerometer sample
+extern volatile int16_t orientation_estimate; //low-pass filtered projection, + is right side up
+extern volatile uint8_t orientation_confidence; //0 to 255
+extern volatile int8_t downness; //ranges from -16 (upside down) to 16 (right side up), filtered
+extern volatile int8_t orientation_filtered; //1, -1, or 0 on edge; multiplies the drive commands
+
+extern volatile int16_t brushed_1_power_in; //-255 to 255
+extern volatile int16_t brushed_2_power_in; //-255 to 255
+
+void control_inputs(void); //combine each A/B receiver pair into a signed power, call after rx_update()
+void control_battery(uint16_t mv); //new filtered battery voltage: look up the output gains, no divides
+void control_sample(void); //new accelerometer sample in xyz: update orientation and traction control
+void control_output(void); //every tick, after control_inputs(): shape the drive and write the motor outputs
+void control_accel_lost(void); //samples stopped: forget the orientation, drive as if right side up
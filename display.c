@@ -0,0 +1,102 @@
+#include "display.h"
+#include "pins.h"
+#include "tables.h"
+#include <stdint.h>
+#include <avr/pgmspace.h>
+
+uint8_t display_seq[2][3][DISPLAY_SEQ_LEN];
+volatile uint8_t display_front = 0;
+uint8_t digit_index = 0;
+
+static const uint8_t PROGMEM digit_array_1[10] = { //add 1 to add a decimal point
+    0xf6, 0xc0, 0x6e, 0xea, 0xd8, 0xba, 0xbe, 0xe0, 0xfe, 0xfa
+};
+
+static const uint8_t PROGMEM digit_array_2[10] = { //add 2 to add a decimal point
+    0xfc, 0x84, 0xd9, 0xd5, 0xa5, 0x75, 0x7d, 0xc4, 0xfd, 0xf5
+};
+
+static const uint8_t digit_pins[3] = {DISP_DIGIT_1_PIN, DISP_DIGIT_2_PIN, DISP_DIGIT_3_PIN};
+
+//the interrupt starts every digit with SER, SRCLOCK and RCLOCK low and the digits off, and each sequence
+//leaves SER low again, so a sequence only depends on its own byte
+static void build_seq(uint8_t* seq, uint8_t v, uint8_t digit_pin) { //v is shifted out LSB first
+    uint8_t ser = v & 1;
+    *seq++ = ser ? DISP_SER_PIN : 0;
+    for (uint8_t i = 0; i < 8; i++) {
+        v >>= 1;
+        uint8_t next = (i < 7) ? (v & 1) : 0; //return SER to low after the last bit
+        *seq++ = DISP_SRCLOCK_PIN; //rising edge shifts in SER
+        *seq++ = DISP_SRCLOCK_PIN | ((ser ^ next) ? DISP_SER_PIN : 0); //falling edge, next bit set up at the same time
+        ser = next;
+    }
+    *seq++ = DISP_RCLOCK_PIN; //latch
+    *seq = DISP_RCLOCK_PIN | digit_pin;
+}
+
+static void show(uint8_t d1, uint8_t d2, uint8_t d3) {
+    uint8_t back = display_front ^ 1;
+    build_seq(display_seq[back][0], d1, digit_pins[0]);
+    build_seq(display_seq[back][1], d2, digit_pins[1]);
+    build_seq(display_seq[back][2], d3, digit_pins[2]);
+    display_front = back; //single byte write, the interrupt sees either the old or the new frame
+}
+
+void display_init(void) {
+    DDRx(DISP_SER_PORT) |= DISP_SER_PIN; // sets pin as output (if a pin is not set here it defaults to being an input)
+    DDRx(DISP_SRCLOCK_PORT) |= DISP_SRCLOCK_PIN;
+    DDRx(DISP_RCLOCK_PORT) |= DISP_RCLOCK_PIN;
+    DDRx(DISP_DIGIT_1_PORT) |= DISP_DIGIT_1_PIN;
+    DDRx(DISP_DIGIT_2_PORT) |= DISP_DIGIT_2_PIN;
+    DDRx(DISP_DIGIT_3_PORT) |= DISP_DIGIT_3_PIN;
+
+    WRITE_PIN(DISP_SER_PORT, DISP_SER_PIN, 0);
+    WRITE_PIN(DISP_SRCLOCK_PORT, DISP_SRCLOCK_PIN, 0);
+    WRITE_PIN(DISP_RCLOCK_PORT, DISP_RCLOCK_PIN, 0);
+
+    show(0xFF, 0xFF, 0xFF); //blank
+    show(0xFF, 0xFF, 0xFF);
+}
+
+static uint8_t split(uint16_t* x) { //hundreds digit of x mod 1000, leaves the last two digits in x, no divide
+    uint16_t v = *x;
+    while (v >= 10000) v -= 10000;
+    while (v >= 1000) v -= 1000;
+    uint8_t hundreds = 0;
+    while (v >= 100) {
+        v -= 100;
+        hundreds++;
+    }
+    *x = v;
+    return hundreds;
+}
+
+void set_digits(uint16_t x) { //display 3 digits
+    uint8_t x_hundreds = split(&x);
+    uint8_t bcd = pgm_read_byte(&bcd_table[x]);
+
+    show(~pgm_read_byte(&digit_array_1[bcd & 0x0F]),
+         ~pgm_read_byte(&digit_array_2[bcd >> 4]),
+         ~pgm_read_byte(&digit_array_2[x_hundreds]));
+}
+
+void set_digits_signed(int16_t x) { //display 2 digits with a sign
+    uint8_t sign = x < 0;
+    uint16_t u = sign ? -x : x;
+    split(&u);
+    uint8_t bcd = pgm_read_byte(&bcd_table[u]);
+
+    show(~pgm_read_byte(&digit_array_1[bcd & 0x0F]),
+         ~pgm_read_byte(&digit_array_2[bcd >> 4]),
+         ~(sign<<0)); //location of g segment (the one in the center of the digit)
+}
+
+void set_digits_letter(uint8_t letter, uint8_t x) { //display a letter followed by 2 digits
+    uint16_t u = x;
+    split(&u);
+    uint8_t bcd = pgm_read_byte(&bcd_table[u]);
+
+    show(~pgm_read_byte(&digit_array_1[bcd & 0x0F]),
+         ~pgm_read_byte(&digit_array_2[bcd >> 4]),
+         ~letter);
+}
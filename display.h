@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+#include "pins.h"
+
+#define DISPLAY_DUTY_CYCLE 24 //digit is active 1/N of the time, minimum 3
+
+//every digit is shifted out as a fixed list of PINx writes (each write toggles the pins that are set),
+//precomputed by set_digits() so the refresh interrupt only replays bytes. all display pins must share one port.
+//(USART1 in SPI mode would need SER on TXD1/PB3 and SRCLOCK on XCK1/PB5, which this board doesn't have)
+#define DISPLAY_SEQ_LEN 19 //SER setup, 8 x (clock rise, clock fall + next SER), latch rise, latch fall + digit on
+
+extern uint8_t display_seq[2][3][DISPLAY_SEQ_LEN]; //[buffer][digit][step]
+extern volatile uint8_t display_front; //buffer the interrupt replays, the other one is written by set_digits()
+extern uint8_t digit_index;
+
+void display_init(void);
+void set_digits(uint16_t x); //display 3 digits
+void set_digits_signed(int16_t x); //display 2 digits with a sign
+void set_digits_letter(uint8_t letter, uint8_t x); //display a letter followed by 2 digits, e.g. a fault code
+
+//letters for set_digits_letter(), segments in the wiring of digits 2 and 3
+#define DISPLAY_LETTER_A 0xED
+#define DISPLAY_LETTER_C 0x78
+#define DISPLAY_LETTER_F 0x69
+#define DISPLAY_LETTER_P 0xE9
+#define DISPLAY_LETTER_R 0x09 //lower case r
+
+#define DISPLAY_STEP(i) PINx(DISP_SER_PORT) = seq[i]
+
+static inline void display_refresh(void) { //call from the display timer interrupt
+    WRITE_PIN(DISP_DIGIT_1_PORT, DISP_DIGIT_1_PIN, 0);
+    WRITE_PIN(DISP_DIGIT_2_PORT, DISP_DIGIT_2_PIN, 0);
+    WRITE_PIN(DISP_DIGIT_3_PORT, DISP_DIGIT_3_PIN, 0);
+
+    //each digit is active at 1/24 duty cycle, 1/24 out of phase from the other digits
+    uint8_t d = digit_index - 1;
+    if (d < 3) {
+        const uint8_t* seq = display_seq[display_front][d];
+        DISPLAY_STEP(0);
+        DISPLAY_STEP(1); DISPLAY_STEP(2); DISPLAY_STEP(3); DISPLAY_STEP(4);
+        DISPLAY_STEP(5); DISPLAY_STEP(6); DISPLAY_STEP(7); DISPLAY_STEP(8);
+        DISPLAY_STEP(9); DISPLAY_STEP(10); DISPLAY_STEP(11); DISPLAY_STEP(12);
+        DISPLAY_STEP(13); DISPLAY_STEP(14); DISPLAY_STEP(15); DISPLAY_STEP(16);
+        DISPLAY_STEP(17); DISPLAY_STEP(18);
+    } else if (digit_index == DISPLAY_DUTY_CYCLE) {
+        digit_index = 0;
+    }
+    digit_index++;
+}
@@ -105,6 +105,18 @@ import sys
 #  10 | 3m  | 3-8     MHz
 #  01 | 0m9 | 0.9-3   MHz
 #  00 | 0m4 | 0.4-0.9 MHz
+#
+# Clock profiles (--profile=<opt>) - defaults for --clk-sel and --bod-level, matching CLOCK in the Makefile
+#  rc8    | rc-bod     | 2v7 | Internal RC oscillator (8MHz)
+#  xtal16 | cry-8m-bod | 4v3 | 16MHz crystal, needs >= 3.8V
+#  xtal20 | cry-8m-bod | 4v3 | 20MHz crystal, needs >= 4.5V; the 8m range is specified to 16MHz, so check the
+#         |            |     | crystal starts reliably (or use an external 20MHz oscillator with ext-bod)
+
+PROFILES = {
+    "rc8":    ("rc-bod",     "2v7"),
+    "xtal16": ("cry-8m-bod", "4v3"),
+    "xtal20": ("cry-8m-bod", "4v3"),
+}
 
 def get_cksel_val(opt):
     if opt is None:
@@ -210,11 +222,18 @@ def main():
                    help="Enable clock output on PB0")
     p.add_argument("-s", "--clk-sel", dest="clk_sel", metavar="opt",
                    help="Choose clock source and start-up time (see script for options)")
+    p.add_argument("-p", "--profile", dest="profile", metavar="opt", choices=sorted(PROFILES),
+                   help="Clock profile, sets --clk-sel and --bod-level unless given (see script for options)")
     p.add_argument("fuses", metavar="lfuse,hfuse,efuse", nargs="?",
                    help="Generate arguments for the given fuse bytes (ignore all other options)")
 
     args = p.parse_args()
 
+    if args.profile is not None:
+        clk_sel, bodlevel = PROFILES[args.profile]
+        if args.clk_sel is None:  args.clk_sel = clk_sel
+        if args.bodlevel is None: args.bodlevel = bodlevel
+
     if args.fuses is None:
         # convert arguments to fuse bytes
         efuse = 0xf0
@@ -0,0 +1,7 @@
+#pragma once
+
+// interrupts don't exist on the host: handlers become plain functions the replay driver can call
+
+#define ISR(vector) void vector(void); void vector(void)
+#define sei() ((void)0)
+#define cli() ((void)0)
@@ -0,0 +1,249 @@
+#pragma once
+
+// host build register file: every I/O register is a byte of host_io[] at its ATmega328PB data-space
+// address, so the pins.h DDRx/PINx pointer arithmetic, WRITE_PIN/READ_PIN and the timer register
+// writes in the firmware compile and behave unchanged. the replay driver reads outputs back from here.
+
+#include <stdint.h>
+
+extern volatile uint8_t host_io[0x100];
+
+#define _HOST_IO8(a) (host_io[a])
+#define _HOST_IO16(a) (*(volatile uint16_t*)&host_io[a])
+
+#define PINB _HOST_IO8(0x23)
+#define DDRB _HOST_IO8(0x24)
+#define PORTB _HOST_IO8(0x25)
+#define PINC _HOST_IO8(0x26)
+#define DDRC _HOST_IO8(0x27)
+#define PORTC _HOST_IO8(0x28)
+#define PIND _HOST_IO8(0x29)
+#define DDRD _HOST_IO8(0x2A)
+#define PORTD _HOST_IO8(0x2B)
+#define PINE _HOST_IO8(0x2C)
+#define DDRE _HOST_IO8(0x2D)
+#define PORTE _HOST_IO8(0x2E)
+#define TIFR0 _HOST_IO8(0x35)
+#define TIFR1 _HOST_IO8(0x36)
+#define TIFR2 _HOST_IO8(0x37)
+#define TIFR3 _HOST_IO8(0x38)
+#define TIFR4 _HOST_IO8(0x39)
+#define PCIFR _HOST_IO8(0x3B)
+#define GPIOR0 _HOST_IO8(0x3E)
+#define EECR _HOST_IO8(0x3F)
+#define EEDR _HOST_IO8(0x40)
+#define EEAR _HOST_IO16(0x41)
+#define TCCR0A _HOST_IO8(0x44)
+#define TCCR0B _HOST_IO8(0x45)
+#define TCNT0 _HOST_IO8(0x46)
+#define OCR0A _HOST_IO8(0x47)
+#define OCR0B _HOST_IO8(0x48)
+#define GPIOR1 _HOST_IO8(0x4A)
+#define GPIOR2 _HOST_IO8(0x4B)
+#define SMCR _HOST_IO8(0x53)
+#define MCUSR _HOST_IO8(0x54)
+#define MCUCR _HOST_IO8(0x55)
+#define SPL _HOST_IO8(0x5D)
+#define SP _HOST_IO16(0x5D)
+#define SREG _HOST_IO8(0x5F)
+#define WDTCSR _HOST_IO8(0x60)
+#define CLKPR _HOST_IO8(0x61)
+#define PRR0 _HOST_IO8(0x64)
+#define PRR1 _HOST_IO8(0x65)
+#define PCICR _HOST_IO8(0x68)
+#define EICRA _HOST_IO8(0x69)
+#define PCMSK0 _HOST_IO8(0x6B)
+#define PCMSK1 _HOST_IO8(0x6C)
+#define PCMSK2 _HOST_IO8(0x6D)
+#define TIMSK0 _HOST_IO8(0x6E)
+#define TIMSK1 _HOST_IO8(0x6F)
+#define TIMSK2 _HOST_IO8(0x70)
+#define TIMSK3 _HOST_IO8(0x71)
+#define TIMSK4 _HOST_IO8(0x72)
+#define PCMSK3 _HOST_IO8(0x73)
+#define ADC _HOST_IO16(0x78)
+#define ADCW _HOST_IO16(0x78)
+#define ADCL _HOST_IO8(0x78)
+#define ADCH _HOST_IO8(0x79)
+#define ADCSRA _HOST_IO8(0x7A)
+#define ADCSRB _HOST_IO8(0x7B)
+#define ADMUX _HOST_IO8(0x7C)
+#define DIDR0 _HOST_IO8(0x7E)
+#define TCCR1A _HOST_IO8(0x80)
+#define TCCR1B _HOST_IO8(0x81)
+#define TCCR1C _HOST_IO8(0x82)
+#define TCNT1 _HOST_IO16(0x84)
+#define ICR1 _HOST_IO16(0x86)
+#define OCR1A _HOST_IO16(0x88)
+#define OCR1B _HOST_IO16(0x8A)
+#define TCCR3A _HOST_IO8(0x90)
+#define TCCR3B _HOST_IO8(0x91)
+#define TCNT3 _HOST_IO16(0x94)
+#define ICR3 _HOST_IO16(0x96)
+#define OCR3A _HOST_IO16(0x98)
+#define OCR3B _HOST_IO16(0x9A)
+#define TCCR4A _HOST_IO8(0xA0)
+#define TCCR4B _HOST_IO8(0xA1)
+#define TCNT4 _HOST_IO16(0xA4)
+#define ICR4 _HOST_IO16(0xA6)
+#define OCR4A _HOST_IO16(0xA8)
+#define OCR4B _HOST_IO16(0xAA)
+#define SPCR1 _HOST_IO8(0xAC)
+#define SPSR1 _HOST_IO8(0xAD)
+#define SPDR1 _HOST_IO8(0xAE)
+#define TCCR2A _HOST_IO8(0xB0)
+#define TCCR2B _HOST_IO8(0xB1)
+#define TCNT2 _HOST_IO8(0xB2)
+#define TWBR0 _HOST_IO8(0xB8)
+#define TWSR0 _HOST_IO8(0xB9)
+#define TWDR0 _HOST_IO8(0xBB)
+#define TWCR0 _HOST_IO8(0xBC)
+#define UCSR0A _HOST_IO8(0xC0)
+#define UCSR0B _HOST_IO8(0xC1)
+#define UCSR0C _HOST_IO8(0xC2)
+#define UBRR0 _HOST_IO16(0xC4)
+#define UDR0 _HOST_IO8(0xC6)
+#define UCSR1A _HOST_IO8(0xC8)
+#define UCSR1B _HOST_IO8(0xC9)
+#define UCSR1C _HOST_IO8(0xCA)
+#define UBRR1 _HOST_IO16(0xCC)
+#define UDR1 _HOST_IO8(0xCE)
+
+// register bits
+#define PRADC 0
+#define REFS1 7
+#define REFS0 6
+#define ADLAR 5
+#define MUX3 3
+#define MUX2 2
+#define MUX1 1
+#define MUX0 0
+#define ADEN 7
+#define ADSC 6
+#define ADATE 5
+#define ADIF 4
+#define ADIE 3
+#define ADPS2 2
+#define ADPS1 1
+#define ADPS0 0
+#define ADTS2 2
+#define ADTS1 1
+#define ADTS0 0
+#define ADC3D 3
+#define WGM00 0
+#define WGM01 1
+#define WGM02 3
+#define COM0A1 7
+#define COM0A0 6
+#define COM0B1 5
+#define COM0B0 4
+#define CS00 0
+#define CS01 1
+#define CS02 2
+#define OCIE0A 1
+#define OCIE0B 2
+#define TOIE0 0
+#define WGM10 0
+#define WGM11 1
+#define WGM12 3
+#define WGM13 4
+#define CS10 0
+#define CS11 1
+#define CS12 2
+#define OCIE1A 1
+#define OCIE1B 2
+#define TOIE1 0
+#define OCF1A 1
+#define OCF1B 2
+#define CS21 1
+#define CS20 0
+#define TOIE2 0
+#define WGM30 0
+#define WGM31 1
+#define WGM32 3
+#define WGM33 4
+#define COM3A1 7
+#define COM3A0 6
+#define COM3B1 5
+#define COM3B0 4
+#define CS30 0
+#define CS31 1
+#define CS32 2
+#define WGM40 0
+#define WGM41 1
+#define COM4B1 5
+#define COM4B0 4
+#define WGM42 3
+#define WGM43 4
+#define CS40 0
+#define CS41 1
+#define CS42 2
+#define OCIE4A 1
+#define OCIE4B 2
+#define TOIE4 0
+#define OCF4A 1
+#define OCF4B 2
+#define TWINT 7
+#define TWEA 6
+#define TWSTA 5
+#define TWSTO 4
+#define TWWC 3
+#define TWEN 2
+#define TWIE 0
+#define TWPS1 1
+#define TWPS0 0
+#define PCIE0 0
+#define PCIE1 1
+#define PCIE2 2
+#define PCIE3 3
+#define SPIE1 7
+#define SPE1 6
+#define DORD1 5
+#define MSTR1 4
+#define CPOL1 3
+#define CPHA1 2
+#define SPR11 1
+#define SPR10 0
+#define SPIF1 7
+#define SPI2X1 0
+#define PRSPI1 2
+#define PRTWI0 7
+#define PRTIM1 3
+#define PRTIM3 3
+#define PRTIM4 5
+#define RXC0 7
+#define TXC0 6
+#define UDRE0 5
+#define FE0 4
+#define DOR0 3
+#define UPE0 2
+#define U2X0 1
+#define RXCIE0 7
+#define RXEN0 4
+#define TXEN0 3
+#define UCSZ02 2
+#define UPM01 5
+#define UPM00 4
+#define USBS0 3
+#define UCSZ01 2
+#define UCSZ00 1
+#define TXEN1 3
+#define UDRE1 5
+#define U2X1 1
+#define UCSZ11 2
+#define UCSZ10 1
+#define SE 0
+#define SM0 1
+#define SM1 2
+#define SM2 3
+#define WDRF 3
+#define BORF 2
+#define EXTRF 1
+#define PORF 0
+#define WDCE 4
+#define WDE 3
+#define WDIE 6
+#define EERE 0
+#define EEPE 1
+#define EEMPE 2
+#define PUD 4
@@ -0,0 +1,3 @@
+#include <avr/io.h>
+
+volatile uint8_t host_io[0x100];
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <stdint.h>
+
+//virtual accelerometer behind host/i2c_host.c
+extern int16_t host_accel[3];
+extern uint32_t host_i2c_transactions;
+void host_accel_push(const int16_t sample[3]); //new sample becomes readable, fifo level goes up by one
@@ -0,0 +1,178 @@
+// host build of the control pipeline: replays a recorded trace (or random input) through
+// control.c, accel.c and motor.c, checks output invariants and reports the cost per step.
+//
+// usage: replay [options] [trace.csv]
+//   --out FILE    write one line of outputs per step
+//   --fuzz N      run N random steps instead of a trace
+//   --seed S      random seed for --fuzz
+//   --repeat R    replay the trace R times (for timing)
+//
+// trace lines: t_us,duty_1a,duty_1b,duty_2a,duty_2b,brushless_in,brushless_shutdown,x,y,z
+// (receiver values as rx.c reports them, accelerometer in raw counts, 1g = 16384); '#' starts a comment
+
+#include <avr/io.h>
+#include "../rx.h"
+#include "../accel.h"
+#include "../motor.h"
+#include "../control.h"
+#include "../shared.h"
+#include "../perf.h"
+#include "host.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+//rx.c needs pin change interrupts, so the replay supplies its outputs directly
+volatile uint8_t pulse_duty_cycle_brushed[4];
+volatile uint8_t brushless_power_in = 0;
+volatile uint8_t brushless_shutdown = 1;
+volatile uint8_t rx_faults = 0;
+
+spsc_t events; //owned by main.c on the target
+volatile uint16_t perf_isr_max[PERF_ISRS]; //perf.c, which needs the scheduler
+volatile uint16_t perf_isr_counts;
+
+typedef struct {
+    uint32_t t_us;
+    uint8_t duty[4];
+    uint8_t brushless_in;
+    uint8_t shutdown;
+    int16_t xyz[3];
+    uint16_t battery_mv; //0: none, traces leave the battery gain at 1
+} step_t;
+
+static unsigned long violations = 0;
+
+static void check(int ok, const char* what, unsigned long n) {
+    if (ok) return;
+    if (violations < 20) fprintf(stderr, "step %lu: %s\n", n, what);
+    violations++;
+}
+
+static void step(const step_t* s, unsigned long n, FILE* out) {
+    for (int i = 0; i < 4; i++) pulse_duty_cycle_brushed[i] = s->duty[i];
+    brushless_power_in = s->brushless_in;
+    brushless_shutdown = s->shutdown;
+
+    host_accel_push(s->xyz);
+    if (s->battery_mv) control_battery(s->battery_mv);
+
+    //same order as the main loop
+    control_inputs();
+    control_output();
+    accel_poll();
+    while (accel_read(xyz)) {
+        control_sample();
+    }
+    uint8_t event;
+    while (spsc_pop(&events, &event)) {
+        check(0, event == EVENT_ACCEL_OVERRUN ? "accelerometer fifo overrun" : "accelerometer transfer failed", n);
+    }
+
+    check(brushed_1_power >= -255 && brushed_1_power <= 255, "brushed_1_power out of range", n);
+    check(brushed_2_power >= -255 && brushed_2_power <= 255, "brushed_2_power out of range", n);
+    check(brushless_power >= -255 && brushless_power <= 255, "brushless_power out of range", n);
+    check(OCR4B <= OCR4A, "brushless pulse longer than its frame", n);
+    check(orientation_filtered >= -1 && orientation_filtered <= 1, "orientation_filtered out of range", n);
+
+    if (out) {
+        fprintf(out, "%u,%d,%d,%d,%d,%u,%u,%u\n", s->t_us, orientation_filtered, brushed_1_power,
+                brushed_2_power, brushless_power, OCR0A, OCR0B, OCR4B);
+    }
+}
+
+static size_t load_trace(const char* path, step_t** steps) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        exit(1);
+    }
+
+    size_t n = 0, cap = 1024;
+    *steps = malloc(cap * sizeof(step_t));
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] == '#' || line[0] == '\n') continue;
+        unsigned t, d0, d1, d2, d3, b, sd;
+        int x, y, z;
+        if (sscanf(line, "%u,%u,%u,%u,%u,%u,%u,%d,%d,%d", &t, &d0, &d1, &d2, &d3, &b, &sd, &x, &y, &z) != 10) {
+            fprintf(stderr, "%s: bad line: %s", path, line);
+            continue;
+        }
+        if (n == cap) *steps = realloc(*steps, (cap *= 2) * sizeof(step_t));
+        step_t* s = &(*steps)[n++];
+        s->t_us = t;
+        s->duty[0] = d0; s->duty[1] = d1; s->duty[2] = d2; s->duty[3] = d3;
+        s->brushless_in = b;
+        s->shutdown = sd;
+        s->xyz[0] = x; s->xyz[1] = y; s->xyz[2] = z;
+        s->battery_mv = 0;
+    }
+    fclose(f);
+    return n;
+}
+
+static size_t make_fuzz(size_t n, unsigned seed, step_t** steps) {
+    srand(seed);
+    *steps = malloc(n * sizeof(step_t));
+    uint32_t t = 0;
+    for (size_t i = 0; i < n; i++) {
+        step_t* s = &(*steps)[i];
+        t += 1000 + rand() % 9000;
+        s->t_us = t;
+        for (int c = 0; c < 4; c++) s->duty[c] = rand() & 0xFF;
+        s->brushless_in = rand() & 0xFF;
+        s->shutdown = (rand() & 0xF) == 0;
+        for (int c = 0; c < 3; c++) s->xyz[c] = (int16_t)(rand() & 0xFFFF);
+        s->battery_mv = (rand() & 1) ? rand() % 16000 : 0;
+    }
+    return n;
+}
+
+int main(int argc, char** argv) {
+    const char* trace = NULL;
+    const char* out_path = NULL;
+    unsigned long fuzz = 0, repeat = 1;
+    unsigned seed = 1;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--out") && i + 1 < argc) out_path = argv[++i];
+        else if (!strcmp(argv[i], "--fuzz") && i + 1 < argc) fuzz = strtoul(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "--seed") && i + 1 < argc) seed = strtoul(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "--repeat") && i + 1 < argc) repeat = strtoul(argv[++i], NULL, 0);
+        else trace = argv[i];
+    }
+    if (!trace && !fuzz) {
+        fprintf(stderr, "usage: %s [--out FILE] [--repeat R] trace.csv | --fuzz N [--seed S]\n", argv[0]);
+        return 1;
+    }
+
+    step_t* steps;
+    size_t n = trace ? load_trace(trace, &steps) : make_fuzz(fuzz, seed, &steps);
+    FILE* out = out_path ? fopen(out_path, "w") : NULL;
+
+    motor_init();
+    if (!accel_init()) {
+        fprintf(stderr, "accel_init failed against the virtual sensor\n");
+        return 1;
+    }
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    unsigned long count = 0;
+    for (unsigned long r = 0; r < repeat; r++) {
+        for (size_t i = 0; i < n; i++) step(&steps[i], count++, out);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+    printf("%lu steps in %.3f s: %.2f M steps/s, %.1f ns/step, %u i2c transactions\n", count, secs,
+           count / secs / 1e6, secs * 1e9 / (count ? count : 1), host_i2c_transactions);
+    printf("%lu invariant violations\n", violations);
+
+    if (out) fclose(out);
+    free(steps);
+    return violations != 0;
+}
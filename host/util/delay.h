@@ -0,0 +1,4 @@
+#pragma once
+
+#define _delay_ms(ms) ((void)(ms))
+#define _delay_us(us) ((void)(us))
@@ -1,4 +1,6 @@
 #include "i2c.h"
+#include "pins.h"
+#include "perf.h"
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
@@ -6,163 +8,278 @@
 #include <util/delay.h>
 #include <stdint.h>
 
-#define DEV_ADDR 0x1E // device address
+#define DEV_ADDR 0x1E // device address used by i2c_send/i2c_recv
 
-#define FLAG_NACK 0x1
-#define FLAG_BUSY 0x2
-#define FLAG_READ 0x4 // if 1, the next transfer will be a read
-
-#define SENDBUF_SIZE 16
-#define RECVBUF_SIZE 16
+#define QUEUE_MASK (I2C_QUEUE_SIZE - 1)
 
 // (2*BR*Pre + 16)*SCL = F_CPU
 // 2*BR*Pre = F_CPU/SCL - 16
 #define I2C_FREQ 50000
-#define I2C_DIV ((F_CPU / I2C_FREQ - 16) / 2)
+#define I2C_PRESCALER 1 // TWPS = 0
+#define I2C_DIV ((F_CPU / I2C_FREQ - 16) / (2 * I2C_PRESCALER))
+
+#if I2C_DIV < 10 || I2C_DIV > 255
+#error "I2C_FREQ can't be made with I2C_PRESCALER from this F_CPU"
+#endif
+
+#define TWCR_NEXT ((1 << TWINT) | (1 << TWEN) | (1 << TWIE)) // continue, NACK received byte
+#define TWCR_ACK ((1 << TWEA) | TWCR_NEXT) // continue, ACK received byte
+#define TWCR_START ((1 << TWSTA) | TWCR_NEXT)
+#define TWCR_STOP ((1 << TWSTO) | TWCR_NEXT)
+
+#define RECOVER_HALF_BIT_US 10 // bus recovery clock, about the bus rate
+#define WAIT_STEP_US 10 // status polling interval of the blocking calls
+#define WAIT_STEPS_PER_POLL 100 // i2c_poll() about once a millisecond while blocking
+
+static i2c_txn_t* volatile queue[I2C_QUEUE_SIZE];
+static volatile uint8_t queue_head = 0; // index of the transaction on the bus
+static volatile uint8_t queue_count = 0;
 
-static volatile uint8_t flags = 0;
+static volatile uint8_t bus_active = 0; // a START has been issued and no final STOP yet
+static volatile uint8_t reading = 0; // 1 once the current transaction is in master receive mode
+static volatile uint8_t pos = 0; // byte index within tx or rx of the current transaction
+static volatile uint8_t progress = 0; // bumped by every TWI interrupt
 
-static volatile uint8_t send_count = 0;
-static volatile uint8_t recv_count = 0;
+static uint8_t poll_progress = 0; // progress at the last i2c_poll()
+static uint8_t poll_stalled = 0; // i2c_poll() calls in a row without progress
 
-static volatile uint8_t send_pos = 0;
-static volatile uint8_t recv_pos = 0;
+uint16_t i2c_timeouts = 0;
 
-static volatile uint8_t send_buf[SENDBUF_SIZE];
-static volatile uint8_t recv_buf[RECVBUF_SIZE];
+static void complete(i2c_txn_t* txn, uint8_t status)
+{
+    txn->status = status;
+    queue_head = (queue_head + 1) & QUEUE_MASK;
+    queue_count--;
+
+    // the callback may queue a follow-up transaction; bus_active is still set
+    // so i2c_submit won't issue its own START
+    if (txn->callback) txn->callback(txn);
+}
+
+static void finish(i2c_txn_t* txn, uint8_t status)
+{
+    complete(txn, status);
+
+    if (queue_count > 0)
+    {
+        // STOP followed by START for the next queued transaction
+        TWCR0 = (1 << TWSTA) | TWCR_STOP;
+    }
+    else
+    {
+        TWCR0 = TWCR_STOP;
+        bus_active = 0;
+    }
+}
 
 ISR(TWI0_vect)
 {
+    PERF_ISR_BEGIN();
+    i2c_txn_t* txn = queue[queue_head];
+    progress++;
+
     switch (TWSR0 & TW_STATUS_MASK)
     {
         case TW_START:
+            // write phase first unless there is nothing to write
+            reading = (txn->tx_len == 0) && (txn->rx_len != 0);
+            pos = 0;
+            TWDR0 = (txn->addr << 1) | reading;
+            TWCR0 = TWCR_NEXT;
+            break;
         case TW_REP_START:
-            TWDR0 = (DEV_ADDR << 1);
-            if (flags & FLAG_READ) TWDR0 |= 1; // if FLAG_READ, set read bit
-            TWCR0 = (1 << TWINT) | (1 << TWEN) | (1 << TWIE);
+            TWDR0 = (txn->addr << 1) | 1;
+            TWCR0 = TWCR_NEXT;
             break;
         case TW_MT_SLA_ACK:
         case TW_MT_DATA_ACK:
-            if (send_count > 0)
+            if (pos < txn->tx_len)
             {
-                TWDR0 = send_buf[send_pos];
-                TWCR0 = (1 << TWINT) | (1 << TWEN) | (1 << TWIE);
-                send_count--;
-                send_pos++;
+                TWDR0 = txn->tx[pos];
+                TWCR0 = TWCR_NEXT;
+                pos++;
+            }
+            else if (txn->rx_len != 0)
+            {
+                // repeated start so no other master can take the bus between the register address and the read
+                reading = 1;
+                pos = 0;
+                TWCR0 = TWCR_START;
             }
             else
             {
-                TWCR0 = (1 << TWSTO) | (1 << TWINT) | (1 << TWEN) | (1 << TWIE);
-                flags &= ~(FLAG_BUSY);
+                finish(txn, I2C_DONE);
             }
             break;
         case TW_MT_SLA_NACK:
         case TW_MT_DATA_NACK:
+        case TW_MR_SLA_NACK:
             // cancel the transfer
-            send_count = 0;
-            TWCR0 = (1 << TWSTO) | (1 << TWINT) | (1 << TWEN) | (1 << TWIE);
-            flags |= FLAG_NACK;
-            flags &= ~(FLAG_BUSY);
+            finish(txn, I2C_NACK);
             break;
             // master receive mode
         case TW_MR_SLA_ACK:
-            if (recv_count == 1)
-            {
-                // receive data but send NACK
-                TWCR0 = (1 << TWINT) | (1 << TWEN) | (1 << TWIE);
-            }
-            else
-            {
-                TWCR0 = (1 << TWEA) | (1 << TWINT) | (1 << TWEN) | (1 << TWIE);
-            }
-            break;
-        case TW_MR_SLA_NACK:
-            TWCR0 = (1 << TWSTO) | (1 << TWINT) | (1 << TWEN) | (1 << TWIE);
-            flags |= FLAG_NACK;
-            flags &= ~(FLAG_BUSY);
+            // NACK straight away if only one byte is wanted
+            TWCR0 = (txn->rx_len > 1) ? TWCR_ACK : TWCR_NEXT;
             break;
         case TW_MR_DATA_ACK:
-            // byte received
-            // recv_count assumed to be > 1
-            recv_buf[recv_pos] = TWDR0;
-            recv_pos++;
-            recv_count--;
-            if (recv_count == 1)
-            {
-                // next byte is last; send NACK after
-                TWCR0 = (1 << TWINT) | (1 << TWEN) | (1 << TWIE);
-            }
-            else
-            {
-                TWCR0 = (1 << TWEA) | (1 << TWINT) | (1 << TWEN) | (1 << TWIE);
-            }
+            // byte received, at least one more to come
+            txn->rx[pos] = TWDR0;
+            pos++;
+            // NACK after the next byte if it is the last
+            TWCR0 = (txn->rx_len - pos > 1) ? TWCR_ACK : TWCR_NEXT;
             break;
         case TW_MR_DATA_NACK:
             // last byte received
-            recv_buf[recv_pos] = TWDR0;
-            recv_count = 0;
-            // transfer done, send stop condition
-            TWCR0 |= (1 << TWSTO);
-            TWCR0 = (1 << TWSTO) | (1 << TWINT) | (1 << TWEN) | (1 << TWIE);
-            flags &= ~(FLAG_BUSY);
+            txn->rx[pos] = TWDR0;
+            finish(txn, I2C_DONE);
             break;
         default:
-            TWCR0 = (1 << TWINT) | (1 << TWEN) | (1 << TWIE);
+            // arbitration lost or bus error, give up on this transaction
+            if (queue_count > 0) finish(txn, I2C_NACK);
+            else TWCR0 = TWCR_NEXT;
             break;
     }
+    PERF_ISR_END(PERF_ISR_I2C);
 }
 
-void i2c_init(void)
+static void enable(void)
 {
     TWCR0 = (1 << TWEN) | (1 << TWIE);
     TWBR0 = I2C_DIV;
-    TWSR0 = (1 << TWPS0);
+    TWSR0 = 0; // prescaler 1, the divider alone sets I2C_FREQ
 }
 
-uint8_t i2c_send(const uint8_t* data, uint8_t len)
+void i2c_init(void)
+{
+    i2c_recover(); // a reset in the middle of a read can leave the sensor holding SDA low
+    enable();
+}
+
+void i2c_recover(void)
 {
-    // truncate length to the send buffer size
-    if (len > SENDBUF_SIZE) len = SENDBUF_SIZE;
+    // open drain by hand: PORT stays 0, DDR pulls a line low or lets the pullup raise it
+    TWCR0 = 0;
+    WRITE_PIN(I2C_SDA_PORT, I2C_SDA_PIN, 0);
+    WRITE_PIN(I2C_SCL_PORT, I2C_SCL_PIN, 0);
+    DDRx(I2C_SDA_PORT) &= ~I2C_SDA_PIN;
+    DDRx(I2C_SCL_PORT) &= ~I2C_SCL_PIN;
 
-    for (uint8_t i = 0; i < len; ++i)
+    // a device stuck mid-read lets go of SDA once it has clocked out the rest of its byte, 9 clocks at most
+    for (uint8_t i = 0; i < 9 && !READ_PIN(I2C_SDA_PORT, I2C_SDA_PIN); i++)
     {
-        send_buf[i] = data[i];
+        DDRx(I2C_SCL_PORT) |= I2C_SCL_PIN;
+        _delay_us(RECOVER_HALF_BIT_US);
+        DDRx(I2C_SCL_PORT) &= ~I2C_SCL_PIN;
+        _delay_us(RECOVER_HALF_BIT_US);
     }
-    send_count = len;
-    send_pos = 0;
-    flags |= FLAG_BUSY;
-    flags &= ~(FLAG_READ);
-    flags &= ~(FLAG_NACK);
-    // send start bit
-    TWCR0 = (1 << TWSTA) | (1 << TWINT) | (1 << TWEN) | (1 << TWIE);
-    while (flags & FLAG_BUSY);
-    _delay_ms(1);
-    return (flags & FLAG_NACK) == 0;
+
+    // STOP (SDA rising while SCL is high) so every device starts over from idle
+    DDRx(I2C_SCL_PORT) |= I2C_SCL_PIN;
+    DDRx(I2C_SDA_PORT) |= I2C_SDA_PIN;
+    _delay_us(RECOVER_HALF_BIT_US);
+    DDRx(I2C_SCL_PORT) &= ~I2C_SCL_PIN;
+    _delay_us(RECOVER_HALF_BIT_US);
+    DDRx(I2C_SDA_PORT) &= ~I2C_SDA_PIN;
+    _delay_us(RECOVER_HALF_BIT_US);
 }
 
-uint8_t i2c_recv(uint8_t* data, uint8_t len)
+void i2c_poll(void)
 {
-    if (len > RECVBUF_SIZE) len = RECVBUF_SIZE;
-    
-    recv_count = len;
-    recv_pos = 0;
-    flags |= FLAG_BUSY;
-    flags |= FLAG_READ;
-    flags &= ~(FLAG_NACK);
-
-    TWCR0 = (1 << TWSTA) | (1 << TWINT) | (1 << TWEN) | (1 << TWIE);
-    while (flags & FLAG_BUSY);
-    _delay_ms(1);
-    if (flags & FLAG_NACK)
+    uint8_t p = progress;
+    if (!bus_active || p != poll_progress)
+    {
+        poll_progress = p;
+        poll_stalled = 0;
+        return;
+    }
+    if (++poll_stalled < I2C_TIMEOUT_POLLS) return;
+    poll_stalled = 0;
+
+    uint8_t sreg = SREG;
+    cli();
+    if (!bus_active || progress != p)
     {
-        return 0;
+        SREG = sreg; // finished or moved on after all
+        return;
+    }
+    TWCR0 = 0; // no more TWI interrupts, so the queue is ours until it is re-enabled
+    SREG = sreg;
+
+    i2c_timeouts++;
+    i2c_recover();
+
+    cli();
+    enable();
+    complete(queue[queue_head], I2C_TIMEOUT);
+    if (queue_count > 0)
+    {
+        TWCR0 = TWCR_START;
     }
     else
     {
-        for (uint8_t i = 0; i < len; ++i)
+        bus_active = 0;
+    }
+    SREG = sreg;
+}
+
+uint8_t i2c_submit(i2c_txn_t* txn)
+{
+    uint8_t ok = 0;
+    uint8_t sreg = SREG;
+    cli(); // may be called from main or from a completion callback
+
+    if (queue_count < I2C_QUEUE_SIZE && txn->status != I2C_PENDING)
+    {
+        txn->status = I2C_PENDING;
+        queue[(queue_head + queue_count) & QUEUE_MASK] = txn;
+        queue_count++;
+        ok = 1;
+
+        if (!bus_active)
         {
-            data[i] = recv_buf[i];
+            // send start bit, the ISR takes it from here
+            bus_active = 1;
+            TWCR0 = TWCR_START;
         }
-        return 1;
     }
+
+    SREG = sreg;
+    return ok;
+}
+
+static void wait_step(uint8_t* steps)
+{
+    _delay_us(WAIT_STEP_US);
+    if (++*steps >= WAIT_STEPS_PER_POLL)
+    {
+        *steps = 0;
+        i2c_poll(); // the main loop isn't running its own, so a stuck bus can't hang the caller
+    }
+}
+
+static uint8_t i2c_blocking(i2c_txn_t* txn)
+{
+    uint8_t steps = 0;
+    while (!i2c_submit(txn)) wait_step(&steps); // wait for room in the queue
+    while (txn->status == I2C_PENDING) wait_step(&steps);
+    return txn->status == I2C_DONE;
+}
+
+uint8_t i2c_send(const uint8_t* data, uint8_t len)
+{
+    i2c_txn_t txn = {DEV_ADDR, data, len, 0, 0, 0, I2C_IDLE};
+    return i2c_blocking(&txn);
+}
+
+uint8_t i2c_recv(uint8_t* data, uint8_t len)
+{
+    i2c_txn_t txn = {DEV_ADDR, 0, 0, data, len, 0, I2C_IDLE};
+    return i2c_blocking(&txn);
+}
+
+uint8_t i2c_read_reg(uint8_t reg, uint8_t* data, uint8_t len)
+{
+    i2c_txn_t txn = {DEV_ADDR, &reg, 1, data, len, 0, I2C_IDLE};
+    return i2c_blocking(&txn);
 }
@@ -2,6 +2,37 @@
 
 #include <stdint.h>
 
-void i2c_init(void);
-uint8_t i2c_send(const uint8_t* data, uint8_t len); //data should be a POINTER to the data being sent (using the & operator)
-uint8_t i2c_recv(uint8_t* data, uint8_t len); //data should be a POINTER to the variable that receives the data (using the & operator)
+#define I2C_QUEUE_SIZE 4 //max number of transactions waiting for the bus, must be a power of 2
+
+//transaction status
+#define I2C_IDLE 0 //not queued (or result already consumed by the caller)
+#define I2C_PENDING 1 //queued or on the bus
+#define I2C_DONE 2 //finished, rx buffer is valid
+#define I2C_NACK 3 //device did not acknowledge, transaction was cancelled
+#define I2C_TIMEOUT 4 //bus stopped making progress, transaction was cancelled and the bus recovered
+
+#define I2C_TIMEOUT_POLLS 2 //i2c_poll() calls without a TWI interrupt before a transaction is cancelled (a byte takes 0.2 ms)
+
+typedef struct i2c_txn i2c_txn_t;
+typedef void (*i2c_callback_t)(i2c_txn_t* txn); //runs inside ISR(TWI0_vect) when the transaction finishes, keep it short
+
+struct i2c_txn {
+    uint8_t addr; //7-bit device address
+    const uint8_t* tx; //written first (e.g. the register address), may be 0 bytes
+    uint8_t tx_len;
+    uint8_t* rx; //read after a repeated start, may be 0 bytes
+    uint8_t rx_len;
+    i2c_callback_t callback; //may be 0
+    volatile uint8_t status; //I2C_IDLE, I2C_PENDING, I2C_DONE or I2C_NACK
+};
+
+extern uint16_t i2c_timeouts; //transactions cancelled by i2c_poll() since boot
+
+void i2c_init(void); //frees a bus a device is holding (i2c_recover()), then enables TWI0
+void i2c_recover(void); //with TWI0 off: clock SCL until the device releases SDA, then a STOP
+void i2c_poll(void); //call about once a millisecond: cancels a stalled transaction, recovers the bus and moves on to the next
+uint8_t i2c_submit(i2c_txn_t* txn); //queue a transaction without blocking, returns 0 if the queue is full or txn is already pending
+uint8_t i2c_send(const uint8_t* data, uint8_t len); //blocking write to the default device, data should be a POINTER to the data being sent (using the & operator)
+uint8_t i2c_recv(uint8_t* data, uint8_t len); //blocking read from the default device, data should be a POINTER to the variable that receives the data (using the & operator)
+uint8_t i2c_read_reg(uint8_t reg, uint8_t* data, uint8_t len); //blocking register read from the default device
+//the blocking calls give up after the same timeout as i2c_poll() and return 0, so they always finish within a few ms
@@ -0,0 +1,560 @@
+#!/usr/bin/env python3
+import argparse
+import bisect
+import re
+import sys
+
+# Static worst-case timing and stack check for the interrupt handlers, from avr-objdump -d output
+# This is designed for the atmega328pb (16-bit PC, classic AVR cycle counts) and avr-gcc output
+#
+# For every used vector it finds the longest path (in cycles) from the vector to its reti, including
+# everything it calls, and the deepest stack it can reach. With the rates given by --rate it reports the
+# CPU share of each interrupt and fails (exit 1) when:
+#   - a handler's worst case doesn't fit in one period of its own interrupt (or its --budget)
+#   - the interrupts add up to more than --max-util percent of the CPU
+#   - main's stack plus the deepest interrupt (plus one more on top of any handler that re-enables
+#     interrupts) doesn't fit between the end of .bss and RAMEND (--heap-start / --stack-limit)
+#   - something can't be bounded: a loop with no --loop-bound, recursion, or an indirect call/jump
+#     that isn't a switch table and has no --indirect targets
+#
+# Cycle counts assume every memory access is to SRAM (no wait states). Each interrupt is also charged
+# the 7 cycles to get into it (4 to push the PC and 3 for the jmp in the vector table).
+#
+# Options:
+#   --rate NAME=HZ          how often a vector fires, e.g. TIMER1_COMPA=969 (repeatable)
+#   --budget NAME=CYCLES    tighter limit for one vector than its period (repeatable)
+#   --loop-bound WHERE=N    max iterations of a loop; WHERE is a loop header address (0x...), a symbol
+#                           (every loop in it), or symbol+0xoffset (repeatable)
+#   --indirect SYM=A,B      functions an icall/ijmp inside symbol SYM can reach (repeatable)
+#   --f-cpu HZ              clock (default 8000000)
+#   --max-util PERCENT      total interrupt load limit (default 100)
+#   --heap-start ADDR       address of __heap_start (avr-nm), sets the stack limit to RAMEND+1 minus that
+#   --stack-limit BYTES     or give the limit directly
+#
+# Example:
+#   avr-objdump -d test.elf | python isrcheck.py --rate TIMER2_OVF=31250 -
+
+VECTOR_NAMES = [
+    "RESET", "INT0", "INT1", "PCINT0", "PCINT1", "PCINT2", "WDT", "TIMER2_COMPA", "TIMER2_COMPB",
+    "TIMER2_OVF", "TIMER1_CAPT", "TIMER1_COMPA", "TIMER1_COMPB", "TIMER1_OVF", "TIMER0_COMPA",
+    "TIMER0_COMPB", "TIMER0_OVF", "SPI0_STC", "USART0_RX", "USART0_UDRE", "USART0_TX", "ADC",
+    "EE_READY", "ANALOG_COMP", "TWI0", "SPM_READY", "USART0_START", "PCINT3", "USART1_RX",
+    "USART1_UDRE", "USART1_TX", "USART1_START", "TIMER3_CAPT", "TIMER3_COMPA", "TIMER3_COMPB",
+    "TIMER3_OVF", "CFD", "PTC_EOC", "PTC_WCOMP", "SPI1_STC", "TWI1", "TIMER4_CAPT",
+    "TIMER4_COMPA", "TIMER4_COMPB", "TIMER4_OVF",
+]
+
+RAMEND = 0x8FF
+ISR_ENTRY_CYCLES = 7
+RET_ADDR_BYTES = 2
+
+# libgcc helpers with loops whose trip counts are fixed
+LIB_LOOP_BOUNDS = {
+    "__udivmodqi4": 9,
+    "__udivmodhi4": 17,
+    "__udivmodsi4": 33,
+}
+
+# cycles for the straight-line case; branches, skips and calls are handled where the edges are built
+CYCLES = {
+    "adiw": 2, "sbiw": 2,
+    "mul": 2, "muls": 2, "mulsu": 2, "fmul": 2, "fmuls": 2, "fmulsu": 2,
+    "ld": 2, "ldd": 2, "lds": 2, "st": 2, "std": 2, "sts": 2,
+    "push": 2, "pop": 2,
+    "lpm": 3, "elpm": 3,
+    "sbi": 2, "cbi": 2,
+    "rjmp": 2, "jmp": 3, "ijmp": 2,
+    "rcall": 3, "call": 4, "icall": 3,
+    "ret": 4, "reti": 4,
+}
+
+BRANCHES = {
+    "brbs", "brbc", "breq", "brne", "brcs", "brcc", "brsh", "brlo", "brmi", "brpl", "brge", "brlt",
+    "brhs", "brhc", "brts", "brtc", "brvs", "brvc", "brie", "brid",
+}
+
+SKIPS = {"cpse", "sbrc", "sbrs", "sbic", "sbis"}
+
+SYMBOL_RE = re.compile(r"^([0-9a-f]+) <(.+)>:$")
+INSN_RE = re.compile(r"^\s*([0-9a-f]+):\t((?:[0-9a-f]{2} )+)\s*\t?([a-z.]*)\t?([^;]*)(?:;\s*(.*))?$")
+TARGET_RE = re.compile(r"0x([0-9a-f]+)")
+
+
+class Insn:
+    def __init__(self, addr, raw, op, args, comment, symbol):
+        self.addr = addr
+        self.raw = raw
+        self.size = len(raw)
+        self.op = op
+        self.args = [a.strip() for a in args.split(",")] if args.strip() else []
+        self.comment = comment or ""
+        self.symbol = symbol
+        self.cycles = CYCLES.get(op, 1)
+
+    def target(self):
+        # relative branches carry the absolute address in the comment, jmp/call in the operand
+        m = TARGET_RE.search(self.comment) if self.op not in ("jmp", "call") else None
+        if m is None and self.args:
+            m = TARGET_RE.search(self.args[-1])
+        return int(m.group(1), 16) if m else None
+
+
+class Fail(Exception):
+    pass
+
+
+def parse(lines):
+    insns = {}
+    raw_bytes = {}
+    symbols = {}  # address -> name
+    symbol = None
+    for line in lines:
+        line = line.rstrip("\n")
+        m = SYMBOL_RE.match(line)
+        if m:
+            symbol = m.group(2)
+            symbols[int(m.group(1), 16)] = symbol
+            continue
+        m = INSN_RE.match(line)
+        if not m or symbol is None:
+            continue
+        addr = int(m.group(1), 16)
+        raw = [int(b, 16) for b in m.group(2).split()]
+        for i, b in enumerate(raw):
+            raw_bytes[addr + i] = b
+        insns[addr] = Insn(addr, raw, m.group(3), m.group(4), m.group(5), symbol)
+    return insns, raw_bytes, symbols
+
+
+class Analyzer:
+    def __init__(self, insns, raw_bytes, symbols, loop_bounds, indirect):
+        self.insns = insns
+        self.raw = raw_bytes
+        self.symbols = symbols
+        self.by_name = {name: addr for addr, name in symbols.items()}
+        self.loop_bounds = loop_bounds
+        self.indirect = indirect
+        self.addrs = sorted(insns)
+        self.functions = {}  # entry -> (wcet, stack, enables_interrupts); wcet None if unbounded
+        self.unbounded = {}  # entry -> why its wcet is None
+        self.active = set()
+
+    def lookup(self, name, where):
+        if name not in self.by_name:
+            raise Fail("%s: --indirect target %s isn't in the listing" % (where, name))
+        return self.by_name[name]
+
+    def prev(self, addr):
+        i = bisect.bisect_left(self.addrs, addr)
+        return self.addrs[i - 1] if i > 0 else None
+
+    def word(self, addr):
+        return self.raw[addr] | (self.raw[addr + 1] << 8)
+
+    def name(self, addr):
+        best = max((a for a in self.symbols if a <= addr), default=None)
+        if best is None:
+            return "0x%x" % addr
+        return self.symbols[best] if best == addr else "%s+0x%x" % (self.symbols[best], addr - best)
+
+    def switch_table(self, insn):
+        # gcc switch: Z = index - (-table) via subi/sbci, bounds checked with cpi, then jmp __tablejump2__;
+        # the table holds word addresses of the cases
+        lo = hi = count = None
+        a = insn.addr
+        for _ in range(24):
+            a = self.prev(a)
+            if a is None:
+                break
+            p = self.insns[a]
+            if p.op == "subi" and p.args[0] == "r30" and lo is None:
+                lo = int(p.args[1], 0)
+            elif p.op == "sbci" and p.args[0] == "r31" and hi is None:
+                hi = int(p.args[1], 0)
+            elif p.op == "cpi" and count is None:
+                count = int(p.args[1], 0)
+        if lo is None or hi is None or count is None:
+            return None
+        base = ((-((hi << 8) | lo)) & 0xFFFF) * 2
+        try:
+            return sorted({self.word(base + 2 * i) * 2 for i in range(count)})
+        except KeyError:
+            return None
+
+    def edges(self, insn, where):
+        # (successor, cycles spent in insn on that edge, callee) for every way out of insn
+        op = insn.op
+        nxt = insn.addr + insn.size
+        if op in ("ret", "reti"):
+            return []
+        if op in BRANCHES:
+            return [(nxt, 1, None), (insn.target(), 2, None)]
+        if op in SKIPS:
+            after = self.insns.get(nxt)
+            skip = after.size // 2 if after else 1
+            return [(nxt, 1, None), (nxt + (after.size if after else 2), 1 + skip, None)]
+        if op in ("rjmp", "jmp"):
+            t = insn.target()
+            if self.symbols.get(t) == "__tablejump2__":
+                cases = self.switch_table(insn)
+                if cases is None:
+                    raise Fail("%s: can't decode the switch table at 0x%x" % (where, insn.addr))
+                # jmp + __tablejump2__ (add, adc, lpm, lpm, mov, ijmp)
+                return [(c, insn.cycles + 11, None) for c in cases]
+            return [(t, insn.cycles, None)]
+        if op == "ijmp":
+            targets = self.indirect.get(insn.symbol)
+            if not targets:
+                raise Fail("%s: indirect jump at 0x%x (add --indirect %s=...)" % (where, insn.addr, insn.symbol))
+            return [(self.lookup(t, where), insn.cycles, None) for t in targets]
+        if op in ("rcall", "call"):
+            t = insn.target()
+            if t == nxt:  # rcall .+0 reserves two bytes of stack frame
+                return [(nxt, insn.cycles, None)]
+            return [(nxt, insn.cycles, t)]
+        if op == "icall":
+            targets = self.indirect.get(insn.symbol)
+            if not targets:
+                raise Fail("%s: indirect call at 0x%x (add --indirect %s=...)" % (where, insn.addr, insn.symbol))
+            return [(nxt, insn.cycles, [self.lookup(t, where) for t in targets])]
+        return [(nxt, insn.cycles, None)]
+
+    def stack_delta(self, insn):
+        if insn.op == "push":
+            return 1
+        if insn.op == "pop":
+            return -1
+        if insn.op == "rcall" and insn.target() == insn.addr + insn.size:
+            return RET_ADDR_BYTES
+        if insn.op == "out" and insn.args[0] == "0x3d":  # SPL written: frame set up or torn down
+            a = insn.addr
+            for _ in range(6):
+                a = self.prev(a)
+                if a is None:
+                    break
+                p = self.insns[a]
+                if p.args and p.args[0] == "r28":
+                    if p.op in ("sbiw", "subi"):
+                        return int(p.args[1], 0)
+                    if p.op == "adiw":
+                        return -int(p.args[1], 0)
+        return 0
+
+    def bound(self, header, function):
+        name = self.name(header)
+        sym = name.split("+")[0]
+        for key in ("0x%x" % header, name, sym, function):
+            if key in self.loop_bounds:
+                return self.loop_bounds[key]
+        for key in (sym, function):
+            if key in LIB_LOOP_BOUNDS:
+                return LIB_LOOP_BOUNDS[key]
+        return None
+
+    def analyze(self, entry):
+        # worst case cycles (None if the code never returns) and stack bytes for the function at entry
+        if entry in self.functions:
+            return self.functions[entry]
+        where = self.name(entry)
+        if entry in self.active:
+            raise Fail("%s: recursion" % where)
+        if entry not in self.insns:
+            raise Fail("%s: no code at 0x%x" % (where, entry))
+        self.active.add(entry)
+
+        # control flow graph of this function
+        succ = {}
+        order = []
+        seen = set()
+        work = [entry]
+        while work:
+            a = work.pop()
+            if a in seen:
+                continue
+            seen.add(a)
+            if a not in self.insns:
+                raise Fail("%s: path runs into 0x%x, which isn't code" % (where, a))
+            order.append(a)
+            succ[a] = self.edges(self.insns[a], where)
+            for s, _, _ in succ[a]:
+                work.append(s)
+
+        # callee costs
+        call_cycles = {}
+        call_stack = {}
+        enables = False
+        for a in order:
+            insn = self.insns[a]
+            if insn.op == "sei":
+                enables = True
+            for _, _, callee in succ[a]:
+                if callee is None:
+                    continue
+                callees = callee if isinstance(callee, list) else [callee]
+                worst_c, worst_s = 0, 0
+                for c in callees:
+                    c_cycles, c_stack, c_enables = self.analyze(c)
+                    if c_cycles is None:
+                        if worst_c is not None and entry not in self.unbounded:
+                            self.unbounded[entry] = self.unbounded.get(c, "%s never returns" % self.name(c))
+                        worst_c = None
+                    elif worst_c is not None:
+                        worst_c = max(worst_c, c_cycles)
+                    worst_s = max(worst_s, c_stack)
+                    enables = enables or c_enables
+                call_cycles[a] = worst_c
+                call_stack[a] = worst_s + RET_ADDR_BYTES
+
+        # back edges from a depth first search
+        back = set()
+        state = {}
+        stack = [(entry, iter(succ[entry]))]
+        state[entry] = 1
+        while stack:
+            node, it = stack[-1]
+            for s, _, _ in it:
+                if state.get(s) == 1:
+                    back.add((node, s))
+                elif s not in state:
+                    state[s] = 1
+                    stack.append((s, iter(succ[s])))
+                    break
+            else:
+                state[node] = 2
+                stack.pop()
+
+        dag = {a: [(s, c) for s, c, _ in succ[a] if (a, s) not in back] for a in order}
+        topo = self.topo_sort(entry, dag)
+
+        def node_cost(a):
+            c = call_cycles.get(a, 0)
+            return None if c is None else c
+
+        # loops: iteration cost of each natural loop, innermost (smallest) first, charged to the header
+        loops = {}
+        for tail, header in back:
+            body = {header}
+            work = [tail]
+            preds = {}
+            for a in order:
+                for s, _ in dag[a]:
+                    preds.setdefault(s, []).append(a)
+            while work:
+                n = work.pop()
+                if n in body:
+                    continue
+                body.add(n)
+                work.extend(preds.get(n, []))
+            loops.setdefault(header, [set(), []])
+            loops[header][0] |= body
+            loops[header][1].append(tail)
+
+        extra = {}
+        for header in sorted(loops, key=lambda h: len(loops[h][0])):
+            body, tails = loops[header]
+            n = self.bound(header, where)
+            if n is None:
+                self.unbounded.setdefault(entry, "%s: loop at 0x%x (%s) has no bound (add --loop-bound 0x%x=N)"
+                                          % (where, header, self.name(header), header))
+                extra[header] = None
+                continue
+            dist = self.longest(header, dag, topo, node_cost, extra, body)
+            iteration = 0
+            for tail in tails:
+                if dist.get(tail) is None:
+                    iteration = None
+                    break
+                back_cost = max(c for s, c, _ in succ[tail] if s == header)
+                iteration = max(iteration, dist[tail] + back_cost)
+            extra[header] = None if iteration is None else iteration * (n - 1)
+
+        # whole function: longest path to a ret/reti
+        dist = self.longest(entry, dag, topo, node_cost, extra, None)
+        cycles = None
+        for a in order:
+            if self.insns[a].op in ("ret", "reti") and dist.get(a) is not None:
+                total = dist[a] + self.insns[a].cycles
+                cycles = total if cycles is None else max(cycles, total)
+        if any(dist.get(a, 0) is None for a in order if self.insns[a].op in ("ret", "reti")):
+            cycles = None
+
+        # deepest stack: depth before each instruction, plus whatever a call puts on top
+        depth = {entry: 0}
+        worst = 0
+        for a in topo:
+            if a not in depth:
+                continue
+            d = depth[a]
+            worst = max(worst, d + call_stack.get(a, 0))
+            nd = d + self.stack_delta(self.insns[a])
+            worst = max(worst, nd)
+            for s, _ in dag[a]:
+                if depth.get(s, -1) < nd:
+                    depth[s] = nd
+
+        self.active.discard(entry)
+        self.functions[entry] = (cycles, worst, enables)
+        return self.functions[entry]
+
+    def topo_sort(self, entry, dag):
+        out = []
+        seen = set()
+        stack = [(entry, iter(dag[entry]))]
+        seen.add(entry)
+        while stack:
+            node, it = stack[-1]
+            for s, _ in it:
+                if s not in seen:
+                    seen.add(s)
+                    stack.append((s, iter(dag[s])))
+                    break
+            else:
+                out.append(node)
+                stack.pop()
+        out.reverse()
+        return out
+
+    def longest(self, start, dag, topo, node_cost, extra, within):
+        # longest distance (cycles spent before executing each node) from start, None = unbounded
+        dist = {start: 0}
+        for a in topo:
+            if a not in dist or (within is not None and a not in within):
+                continue
+            d = dist[a]
+            if d is not None:
+                c = node_cost(a)
+                e = extra.get(a, 0) if a != start or within is None else 0
+                d = None if c is None or e is None else d + c + e
+            for s, cost in dag[a]:
+                if within is not None and s not in within:
+                    continue
+                nd = None if d is None else d + cost
+                if s not in dist or nd is None or (dist[s] is not None and nd > dist[s]):
+                    dist[s] = nd
+        return dist
+
+    def vectors(self):
+        out = {}
+        base = self.by_name.get("__vectors")
+        if base is None:
+            raise Fail("no __vectors table in the listing")
+        for i, name in enumerate(VECTOR_NAMES):
+            insn = self.insns.get(base + 4 * i)
+            if i == 0 or insn is None or insn.op not in ("jmp", "rjmp"):
+                continue
+            t = insn.target()
+            if self.symbols.get(t) == "__bad_interrupt":
+                continue
+            out[name] = t
+        return out
+
+
+def parse_pairs(values, what, convert):
+    out = {}
+    for v in values or []:
+        if "=" not in v:
+            raise SystemExit("bad %s '%s', expected NAME=VALUE" % (what, v))
+        k, val = v.split("=", 1)
+        out[k] = convert(val)
+    return out
+
+
+def main():
+    p = argparse.ArgumentParser(description="Worst-case interrupt timing and stack check from avr-objdump -d output")
+    p.add_argument("listing", nargs="?", default="-", help="avr-objdump -d output (default: stdin)")
+    p.add_argument("--rate", action="append", metavar="NAME=HZ", help="interrupt rate")
+    p.add_argument("--budget", action="append", metavar="NAME=CYCLES", help="cycle limit for one vector")
+    p.add_argument("--loop-bound", action="append", metavar="WHERE=N", help="loop iteration bound")
+    p.add_argument("--indirect", action="append", metavar="SYM=A,B", help="targets of indirect calls in SYM")
+    p.add_argument("--f-cpu", type=float, default=8e6, help="clock in Hz")
+    p.add_argument("--max-util", type=float, default=100.0, help="interrupt load limit in percent")
+    p.add_argument("--heap-start", type=lambda x: int(x, 0), help="__heap_start address from avr-nm")
+    p.add_argument("--stack-limit", type=int, help="bytes available for the stack")
+    args = p.parse_args()
+
+    rates = parse_pairs(args.rate, "rate", float)
+    budgets = parse_pairs(args.budget, "budget", int)
+    loop_bounds = parse_pairs(args.loop_bound, "loop bound", int)
+    loop_bounds = {(k.lower() if k.startswith("0x") else k): v for k, v in loop_bounds.items()}
+    indirect = parse_pairs(args.indirect, "indirect targets", lambda x: x.split(","))
+
+    stack_limit = args.stack_limit
+    if args.heap_start is not None:
+        stack_limit = RAMEND + 1 - (args.heap_start & 0xFFFF)
+
+    f = sys.stdin if args.listing == "-" else open(args.listing)
+    insns, raw_bytes, symbols = parse(f)
+    a = Analyzer(insns, raw_bytes, symbols, loop_bounds, indirect)
+
+    errors = []
+    try:
+        vectors = a.vectors()
+    except Fail as e:
+        print("error: %s" % e)
+        return 1
+
+    for name in list(rates) + list(budgets):
+        if name not in vectors:
+            print("note: %s has a rate or budget but no handler in this build" % name)
+
+    print("%-14s %10s %10s %10s %8s %8s" % ("vector", "rate Hz", "wcet cyc", "budget cyc", "stack B", "cpu %"))
+    load = 0.0
+    isr_stacks = {}
+    for name, entry in vectors.items():
+        try:
+            cycles, stack, enables = a.analyze(entry)
+        except Fail as e:
+            errors.append(str(e))
+            print("%-14s %10s %10s %10s %8s %8s" % (name, "", "?", "", "?", ""))
+            continue
+        stack += RET_ADDR_BYTES
+        isr_stacks[name] = (stack, enables)
+        if cycles is None:
+            errors.append("%s: %s" % (name, a.unbounded.get(entry, "never returns")))
+            print("%-14s %10s %10s %10s %8d %8s" % (name, "", "?", "", stack, ""))
+            continue
+        cycles += ISR_ENTRY_CYCLES
+        rate = rates.get(name)
+        budget = budgets.get(name)
+        if rate:
+            budget = min(budget, int(args.f_cpu / rate)) if budget else int(args.f_cpu / rate)
+        util = 100.0 * cycles * rate / args.f_cpu if rate else None
+        if util is not None:
+            load += util
+        print("%-14s %10s %10d %10s %8d %8s" % (name, "%g" % rate if rate else "-", cycles,
+              budget if budget else "-", stack, "%.2f" % util if util is not None else "-"))
+        if budget and cycles > budget:
+            errors.append("%s: worst case %d cycles is over its budget of %d" % (name, cycles, budget))
+        if not rate:
+            errors.append("%s: no --rate given, its CPU share is unknown" % name)
+
+    print("interrupt load: %.2f %% (limit %g %%)" % (load, args.max_util))
+    if load > args.max_util:
+        errors.append("interrupt load %.2f %% is over %g %%" % (load, args.max_util))
+
+    main_stack = None
+    if "main" in a.by_name:
+        try:
+            main_stack = a.analyze(a.by_name["main"])[1]
+        except Fail as e:
+            errors.append(str(e))
+    if main_stack is not None and isr_stacks:
+        # interrupts don't nest unless a handler re-enables them, then any other one can land on top
+        worst_isr = max(s for s, _ in isr_stacks.values())
+        nested = 0
+        for name, (s, enables) in isr_stacks.items():
+            if enables:
+                others = [o for n, (o, _) in isr_stacks.items() if n != name]
+                nested = max(nested, s + (max(others) if others else 0))
+        combined = main_stack + max(worst_isr, nested)
+        print("stack: main %d + interrupts %d = %d bytes%s" % (main_stack, max(worst_isr, nested), combined,
+              " (limit %d)" % stack_limit if stack_limit is not None else ""))
+        if stack_limit is not None and combined > stack_limit:
+            errors.append("worst case stack %d bytes is over the %d available" % (combined, stack_limit))
+
+    for e in errors:
+        print("error: %s" % e)
+    return 1 if errors else 0
+
+if __name__ == "__main__":
+    sys.exit(main())
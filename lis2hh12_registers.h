@@ -1,14 +1,21 @@
 #pragma once
 
+#define LIS2HH12_ADDR 0x1E //7-bit i2c address with SA0 low
+
+#define TEMP_L 0x0B //temperature output register (r)
+#define TEMP_H 0x0C
 #define WHO_AM_I 0x0F //read only register fixed at 41h (65 decimal)
+#define WHO_AM_I_ID 0x41
+#define ACT_THS 0x1E //activity threshold (r/w)
+#define ACT_DUR 0x1F //activity duration (r/w)
 #define CTRL1 0x20 //control register 1 (r/w)
 #define CTRL2 0x21 //control register 2 (r/w)
 #define CTRL3 0x22 //control register 3 (r/w)
 #define CTRL4 0x23 //control register 4 (r/w)
 #define CTRL5 0x24 //control register 5 (r/w)
 #define CTRL6 0x25 //control register 6 (r/w)
-#define CTRL7 0x26 //control register 6 (r/w)
-#define STATUS 0x27 //control register 6 (r/w)
+#define CTRL7 0x26 //control register 7 (r/w)
+#define STATUS 0x27 //status register (r)
 
 #define OUT_X_L 0x28 //x-axis output register (r)
 #define OUT_X_H 0x29
@@ -17,4 +24,58 @@
 #define OUT_Y_H 0x2B
 
 #define OUT_Z_L 0x2C //z-axis output register (r)
-#define OUT_Z_H 0x2D
\ No newline at end of file
+#define OUT_Z_H 0x2D
+
+#define FIFO_CTRL 0x2E //fifo mode and threshold (r/w)
+#define FIFO_SRC 0x2F //fifo status (r)
+
+#define IG_CFG1 0x30 //interrupt generator 1 (r/w)
+#define IG_SRC1 0x31
+#define IG_THS_X1 0x32
+#define IG_THS_Y1 0x33
+#define IG_THS_Z1 0x34
+#define IG_DUR1 0x35
+#define IG_CFG2 0x36 //interrupt generator 2 (r/w)
+#define IG_SRC2 0x37
+#define IG_THS2 0x38
+#define IG_DUR2 0x39
+#define XL_REFERENCE 0x3A //high-pass filter reference, 0x3A to 0x3F (r/w)
+
+//CTRL1 bits
+#define CTRL1_HR (1<<7) //high resolution
+#define CTRL1_ODR_200 (0x4<<4) //output data rate 200 Hz
+#define CTRL1_ODR_400 (0x5<<4) //output data rate 400 Hz
+#define CTRL1_ODR_800 (0x6<<4) //output data rate 800 Hz
+#define CTRL1_BDU (1<<3) //block data update, high and low bytes always come from the same sample
+#define CTRL1_ZEN (1<<2)
+#define CTRL1_YEN (1<<1)
+#define CTRL1_XEN (1<<0)
+
+//CTRL3 bits (INT1 routing)
+#define CTRL3_FIFO_EN (1<<7)
+#define CTRL3_STOP_FTH (1<<6) //limit fifo depth to the threshold
+#define CTRL3_INT1_INACT (1<<5)
+#define CTRL3_INT1_IG2 (1<<4)
+#define CTRL3_INT1_IG1 (1<<3)
+#define CTRL3_INT1_OVR (1<<2) //fifo overrun on INT1
+#define CTRL3_INT1_FTH (1<<1) //fifo threshold on INT1
+#define CTRL3_INT1_DRDY (1<<0) //data ready on INT1
+
+//CTRL4 bits
+#define CTRL4_IF_ADD_INC (1<<2) //register address auto-increment for multi-byte reads (on at reset)
+
+//FIFO_CTRL fields
+#define FIFO_MODE_BYPASS (0x0<<5)
+#define FIFO_MODE_FIFO (0x1<<5) //stop collecting when full
+#define FIFO_MODE_STREAM (0x2<<5) //oldest sample is overwritten when full
+#define FIFO_MODE_STREAM_TO_FIFO (0x3<<5)
+#define FIFO_MODE_BYPASS_TO_STREAM (0x4<<5)
+#define FIFO_FTH_MASK 0x1F //threshold level
+
+//FIFO_SRC bits
+#define FIFO_SRC_FTH (1<<7) //fifo level is at or above the threshold
+#define FIFO_SRC_OVR (1<<6) //fifo full, at least one sample was overwritten
+#define FIFO_SRC_EMPTY (1<<5)
+#define FIFO_SRC_FSS_MASK 0x1F //number of unread samples
+
+#define FIFO_DEPTH 32 //samples
@@ -1,350 +1,332 @@
 #include <avr/io.h>
 #include "pins.h"
 #include "i2c.h"
-#include "lis2hh12_registers.h"
+#include "accel.h"
+#include "rx.h"
+#include "motor.h"
+#include "display.h"
+#include "control.h"
+#include "sd.h"
+#include "shared.h"
+#include "adc.h"
+#include "sched.h"
+#include "calib.h"
+#include "blackbox.h"
+#include "perf.h"
+#include "rx_serial.h"
 #include "util.h"
 #include <stdint.h>
 #include <avr/interrupt.h>
 #include <avr/pgmspace.h>
-
-#define DISPLAY_DUTY_CYCLE 24 //digit is active 1/N of the time, minimum 3
-#define BRUSHLESS_PWM_DIVISOR 20400 //determines PWM frequency for brushless motor (50 Hz)
-#define PWM_MARGIN 1 //if the motor power is within margin of 0 or 255, it will snap to 0 or 255 so the interrupts don't overlap
-#define VOLTAGE_DIVISOR 458; //65472/(1.1*13*10)
-
-#define FLIP_DEADZONE 2 //if orientation is within plus or minus this value, drive train power will be set to 0
-#define FLIP_TIMEOUT 50 //orientation_filtered must stay constant for this many timer cycles (about 0.2s) to update
-
-#define BRUSHED_SAMPLE_LIMIT (120/8) //8000000Hz/(256*260Hz) = 120, number of brushed input signal samples over which their avg. rate is found
-#define BRUSHLESS_SAMPLE_LIMIT (625*2) //8000000Hz/(256*50Hz) = 625, number of brushless input signal samples over which their avg. rate is found
-
-// lis2hh12 register values
-#define CTRL1_VAL 0x4F //01001111
-
-volatile uint8_t i2c_address = 0;
-
-volatile int16_t xyz[3]; //1g = 16384
-const int16_t xyz_down[3] = { //vector indicating which way is down, 1g = 16.384
-    0, 12, -9
+#include <avr/wdt.h>
+
+struct log_record { //one per accelerometer sample, 16 bytes so 32 fit in a sector
+    uint16_t sample;
+    int16_t xyz[3];
+    int16_t brushed_1_power;
+    int16_t brushed_2_power;
+    int16_t brushless_power;
+    int16_t orientation_estimate;
 };
-volatile int8_t downness = 0; //ranges from -16 (upside down) to 16 (right side up), not filtered
-volatile int8_t orientation_mult = 1;
-volatile int8_t orientation_filtered = 1; //for hysteresis noise filtering
-
-volatile uint16_t timer_counter = 0; //max 65536
-volatile uint16_t voltmeter_counter = 0; //another timer counter
-volatile uint16_t i2c_counter = 0;
-volatile uint16_t orientation_counter = 0;
-volatile uint16_t motor_update_counter = 0;
-
-volatile uint16_t speed_ramp = 0;
-
-volatile uint8_t digit1 = 0xFF;
-volatile uint8_t digit2 = 0xFF;
-volatile uint8_t digit3 = 0xFF;
-
-volatile uint16_t voltage;
-volatile uint16_t bubbles = 0;
-
-volatile uint8_t digit_index = 0;
-
-volatile int16_t brushed_1_power = 0; //-255 to 255 (+ is in the direction given by right hand rule with thumb matching shaft, - is opposite)
-volatile int16_t brushed_2_power = 0; //-255 to 255 (+ is in the direction given by right hand rule with thumb matching shaft, - is opposite)
-volatile int16_t brushless_power = 0; //-255 to 255
-
-uint8_t pulse_denominator_brushed = 0;
-uint16_t pulse_denominator_brushless = 0;
-uint8_t pulse_numerator_brushed[4];
-uint16_t pulse_numerator_brushless = 0;
-uint8_t pulse_duty_cycle_brushed[4]; //0 (0%) to 255 (100%) duty cycle
-
-volatile uint8_t brushless_power_in = 0; //0 (0%) to 255 (100%) power, directionless
-volatile int16_t brushed_1_power_in = 0; //-255 to 255
-volatile int16_t brushed_2_power_in = 0; //-255 to 255
-
-volatile uint8_t brushless_shutdown = 1;
-
-
-static const uint8_t PROGMEM digit_array_1[10] = { //add 1 to add a decimal point
-    0xf6, 0xc0, 0x6e, 0xea, 0xd8, 0xba, 0xbe, 0xe0, 0xfe, 0xfa
-};
-
-static const uint8_t PROGMEM digit_array_2[10] = { //add 2 to add a decimal point
-    0xfc, 0x84, 0xd9, 0xd5, 0xa5, 0x75, 0x7d, 0xc4, 0xfd, 0xf5
-};
-
-static inline void adc_init(void) {
-    PRR0 |= (0 << PRADC); //disable ADC power reduction
-    ADMUX = (1 << REFS1) | (1 << REFS0); //select Vref (1.1V) as reference for ADC
-    ADMUX |= (1 << ADLAR); //left adjust result (outputs are 8 bits instead of 10)
-    ADMUX |= (1 << MUX1) | (1 << MUX0); //select ADC3 (PC3) pin for conversion
-    ADCSRA = (1 << ADPS2) | (1 << ADPS1); //ADC input clock divided by 64
-    ADCSRA |= (1 << ADEN) | (1 << ADSC); //enable ADC and perform single conversion as required part of initialization
+static uint16_t log_sample = 0;
+
+spsc_t events;
+uint16_t accel_nacks = 0;
+uint16_t accel_overruns = 0;
+
+//boot and recovery: the watchdog resets the chip if the control task stops running for WDT_TIMEOUT,
+//and a reset that wasn't a plain power up shows "r" and its cause for RESET_SHOW_MS
+#define WDT_TIMEOUT WDTO_60MS
+#define RESET_SHOW_MS 2000
+
+#define RESET_POWER_ON 1
+#define RESET_EXTERNAL 2 //reset pin
+#define RESET_BROWN_OUT 3
+#define RESET_WATCHDOG 4
+
+static uint8_t reset_cause;
+static uint8_t reset_show; //display_task runs left showing the reset cause, set once at boot
+uint16_t boot_us; //main() to the scheduler starting (armed), saturates at 0xFFFF; the fuse start-up delay comes before main()
+
+static uint8_t accel_ok = 0; //sensor answered and took its settings
+uint16_t accel_restarts = 0; //accel_init() calls after a stall
+static uint16_t accel_last_sample = 0; //tick of the last sample
+
+volatile uint16_t voltage; //battery, mV
+static uint16_t voltage_min = 0xFFFF; //lowest since boot
+static uint8_t button_held = 0; //button_task runs the button has been down for, up to BUTTON_HOLD_RUNS
+
+#define BUTTON_PERIOD_MS 20
+#define BUTTON_HOLD_RUNS (CALIB_HOLD_MS/BUTTON_PERIOD_MS)
+
+//display pages, a short press moves to the next one: "P" and the page number for PAGE_LABEL_MS, then its
+//value (up to 999). page 0 is the normal display, the others stay up even with the receiver off
+#define PAGE_LABEL_MS 1000
+#define PAGE_NORMAL 0 //battery voltage, or the reset / fault / accelerometer codes
+#define PAGE_LOAD 1 //CPU load, percent
+#define PAGE_ISR_TICK 2 //longest interrupt per group since boot, us (PERF_ISR_*)
+#define PAGE_ISR_RX 3
+#define PAGE_ISR_I2C 4
+#define PAGE_ISR_ADC 5
+#define PAGE_ISR_PWM 6
+#define PAGE_LOOP_HZ 7 //main loop passes per second, tens
+#define PAGE_ACCEL_HZ 8 //accelerometer samples per second
+#define PAGE_I2C_NACKS 9 //accelerometer transfers the sensor didn't acknowledge
+#define PAGE_I2C_TIMEOUTS 10
+#define PAGE_RX_ERRORS 11 //serial receivers: frames dropped for line or checksum errors; PWM: channel cuts
+#define PAGE_VOLTAGE_MIN 12 //lowest battery voltage, tenths of a volt
+#define PAGES 13
+
+#define DISPLAY_PERIOD_MS 100
+#define PAGE_LABEL_RUNS (PAGE_LABEL_MS/DISPLAY_PERIOD_MS)
+#define RESET_SHOW_RUNS (RESET_SHOW_MS/DISPLAY_PERIOD_MS)
+
+static uint8_t page = PAGE_NORMAL;
+static uint8_t page_label = 0; //display_task runs left showing the page number
+
+
+#if TIMER1_PRESCALER != 8
+#error "init_timer_1() sets the divide by 8 clock select"
+#endif
+_Static_assert(TIMER1_FITS(SCHED_TICK_US), "the scheduler tick must fit in timer 1");
+
+static inline void init_timer_1(void) { //free-running timebase (receiver timestamps, see sched.h) + display timer
+    TCCR1A = 0; //waveform generation mode set to normal, the counter is never reset so it can timestamp edges
+    TCCR1B = (1 << CS11); //clock select bit set to internal clock divided by 8
+    TIMSK1 = (1 << OCIE1A); //interrupt enabled for timer output compare match A
+    OCR1A = SCHED_TICK_COUNTS; //moved forward by SCHED_TICK_COUNTS in the interrupt, 1000000/SCHED_TICK_US = 969 Hz
 }
 
-static inline void set_digits(uint16_t x) { //display 3 digits
-    uint8_t x_hundreds = (x/100) % 10;
-    uint8_t x_tens = (x/10) % 10;
-    uint8_t x_ones = x % 10;
-
-    digit1 = ~pgm_read_byte(&digit_array_1[x_ones]);
-    digit2 = ~pgm_read_byte(&digit_array_2[x_tens]);
-    digit3 = ~pgm_read_byte(&digit_array_2[x_hundreds]);
+static inline void log_control(void) {
+    struct log_record r = {
+        log_sample++,
+        {xyz[0], xyz[1], xyz[2]},
+        brushed_1_power, brushed_2_power, brushless_power,
+        orientation_estimate
+    };
+    sd_log(&r, sizeof(r));
 }
 
-static inline void set_digits_signed(int16_t x) { //display 2 digits with a sign
-    uint8_t sign = x < 0;
-    if (sign) x = -x;
-    uint8_t x_tens = (x/10) % 10;
-    uint8_t x_ones = x % 10;
-
-    digit1 = ~pgm_read_byte(&digit_array_1[x_ones]);
-    digit2 = ~pgm_read_byte(&digit_array_2[x_tens]);
-    digit3 = ~(sign<<0); //location of g segment (the one in the center of the digit)
-}
+ISR(TIMER1_COMPA_vect) //timer 1 interrupt (7seg display, system tick)
+{
+    PERF_ISR_BEGIN();
+    OCR1A += SCHED_TICK_COUNTS; //schedule the next tick without disturbing the free-running count
 
-static inline void init_timer_0(void) { //brushed motor PWM timer
-    TCCR0A = 0; //waveform generation mode set to normal (clear timer on overflow) 
-    TCCR0B = (1 << CS01) | (1 << CS00); //clock select bit set to internal clock divided by 64
-    TIMSK0 = (1 << OCIE0A) | (1 << OCIE0B) | (1 << TOIE0); //interrupt enabled for timer output compare match A and B, and for timer overflow
-    OCR0A = 0; //output compare match A when the timer counts up to this value
-    OCR0B = 0; //output compare match B when the timer counts up to this value
-    //interrupt should occur at 8000000 Hz / (256*64) i.e. at 488 Hz
+    display_refresh();
+    sched_tick();
+    PERF_ISR_END(PERF_ISR_TICK);
 }
 
-static inline void init_timer_1(void) { //display PWM timer
-    TCCR1B = (1 << WGM12); //waveform generation mode set to CTC (clear timer on compare match) 
-    TCCR1B |= (1 << CS11) | (1 << CS10); //clock select bit set to internal clock divided by 64
-    TIMSK1 = (1 << OCIE1A); //interrupt enabled for timer output compare match A
-    OCR1A = 128; //output compare match A when the timer counts up to this value
-    //interrupt should occur at 8000000 Hz / (2*64*(1+OCR1A)) i.e. at 484 Hz
+static void control_task(void) { //receiver inputs to motor outputs, every tick whether or not the accelerometer delivers
+    wdt_reset(); //the watchdog only gets fed while control runs
+    rx_update();
+    control_inputs();
+    control_output();
 }
 
-static inline void init_timer_2(void) { //input pulse sampler timer
-    TCCR2A = 0; //waveform generation mode set to normal (clear timer on overflow) 
-    TCCR2B = (1 << CS21); //clock select bit set to internal clock divided by 1
-    TIMSK2 = (1 << TOIE2); //interrupt enabled for timer overflow
-    //interrupt should occur at 8000000 / (256) i.e. at 31250 Hz
-}
+static void accel_task(void) {
+    uint8_t event;
 
-static inline void init_timer_4(void) { //brushless motor PWM timer
-    TCCR4B = (1 << WGM42); //waveform generation mode set to CTC1 (clear timer on compare match) 
-    TCCR4B |= (1 << CS41); //clock select bit set to internal clock divided by 64
-    TIMSK4 = (1 << OCIE4A) | (1 << OCIE4B); //interrupt enabled for timer output compare match A and B
-    OCR4A = BRUSHLESS_PWM_DIVISOR; //output compare match A when the timer counts up to this value
-    OCR4B = 0; //this variable is the duty cycle times BRUSHLESS_PWM_MULTIPLIER 
-    //interrupt should occur at 8000000 Hz / (2*8*(1+OCR4A)) i.e. at 24.5 Hz ???
-}
+    uint16_t now = read_counter16(&sched_ticks);
+    uint8_t got = 0;
 
-static inline void set_register(uint8_t v) {
-    for (uint8_t i = 0; i < 8; i++) {
-        WRITE_PIN(DISP_SER_PORT, DISP_SER_PIN, v & 1);
-        WRITE_PIN(DISP_SRCLOCK_PORT, DISP_SRCLOCK_PIN, 1);
-        asm volatile("nop\n\t");
-        WRITE_PIN(DISP_SRCLOCK_PORT, DISP_SRCLOCK_PIN, 0);
-        v >>= 1;
-    } 
-    WRITE_PIN(DISP_RCLOCK_PORT, DISP_RCLOCK_PIN, 1);
-    asm volatile("nop\n\t");
-    WRITE_PIN(DISP_RCLOCK_PORT, DISP_RCLOCK_PIN, 0);
-}
+    while (accel_read(xyz)) { //every sample the last burst brought in, in order
+        if (calib_active) calib_sample();
+        control_sample();
+        blackbox_sample(voltage);
+        log_control();
+        perf_accel_samples++;
+        got = 1;
+    }
+    if (got) {
+        accel_last_sample = now;
+    } else if ((uint16_t)(now - accel_last_sample) > SCHED_MS(ACCEL_STALL_MS)) {
+        control_accel_lost(); //the last orientation is stale, drive right side up until samples come back
+        accel_ok = accel_init(); //lost its settings (brown-out, glitch) or gone; a few ms at most
+        accel_restarts++;
+        accel_last_sample = now;
+    }
+    accel_poll(); //next burst runs in the background, picked up on the next run
 
-static inline uint16_t get_battery_voltage(void) {
-    ADCSRA |= (1 << ADSC); //ADC single conversion
-    while(!(ADCSRA & (1<<ADIF)));
-    ADCSRA |= (1<<ADIF);
-    return ((uint16_t)((ADCH << 8) | ADCL))/VOLTAGE_DIVISOR;
+    while (spsc_pop(&events, &event)) {
+        if (event == EVENT_ACCEL_NACK) accel_nacks++;
+        else if (event == EVENT_ACCEL_OVERRUN) accel_overruns++;
+    }
 }
 
-static inline void set_brushed_duty(void) { //call every time brushed_#_power changes
-    brushed_1_power_in = (int16_t)pulse_duty_cycle_brushed[0] - (int16_t)pulse_duty_cycle_brushed[1];
-    brushed_2_power_in = (int16_t)pulse_duty_cycle_brushed[2] - (int16_t)pulse_duty_cycle_brushed[3];
+//the log continues across reboots: calib_sd holds a start for the next boot that stays LOG_RESERVE_BLOCKS ahead
+//of the stream, so a reset never rewinds over a previous log or black box dump. at worst the gap is left unused
+#define LOG_RESERVE_BLOCKS 256 //an EEPROM save every 256 blocks, about 40 s of log
 
-    OCR0A = (uint8_t)(abs_int(brushed_1_power));
-    OCR0B = (uint8_t)(abs_int(brushed_2_power));
-}
+static uint32_t log_block; //where the log stream continues after a black box dump, calib_sd.log_block at boot
+static uint8_t sd_dumping = 0; //the open stream is a black box dump
 
-static inline void set_brushless_duty(void) { //call every time brushed_#_power changes
-    OCR4B = ((uint16_t)(((uint32_t)(brushless_power+755) * BRUSHLESS_PWM_DIVISOR) / (255 * 10 * 4))); //should range from 0.05 duty cycle (ccw) to 0.1 duty cycle (cw)
+static void save_sd_position(uint32_t next_boot_block) {
+    calib_sd.log_block = next_boot_block;
+    calib_sd.blackbox_slot = blackbox.slot;
+    calib_sd_save();
 }
 
-ISR(TIMER0_OVF_vect) { //pwm 1 and 2 on
-    if (abs_int(brushed_1_power) >= PWM_MARGIN) { //i.e. if we don't want the signal snapped to always off
-        WRITE_PIN(BRUSHED_1_A_PORT, BRUSHED_1_A_PIN, brushed_1_power<0);
-        WRITE_PIN(BRUSHED_1_B_PORT, BRUSHED_1_B_PIN, brushed_1_power>0);
-    }
-    if (abs_int(brushed_2_power) >= PWM_MARGIN) { //i.e. if we don't want the signal snapped to always off
-        WRITE_PIN(BRUSHED_2_A_PORT, BRUSHED_2_A_PIN, brushed_2_power<0);
-        WRITE_PIN(BRUSHED_2_B_PORT, BRUSHED_2_B_PIN, brushed_2_power>0);
+static void sd_task(void) {
+    sd_poll();
+    uint8_t state = sd_state();
+    if (state == SD_STREAMING && !sd_dumping) {
+        uint32_t written = log_block + sd_blocks();
+        if (blackbox_frozen()) sd_stop(); //a few ms out of the log to get the black box onto the card
+        else if (written >= calib_sd.log_block) save_sd_position(written + LOG_RESERVE_BLOCKS);
+    } else if (state == SD_READY) {
+        if (!sd_dumping) log_block += sd_blocks(); //0 before the first stream
+        sd_dumping = blackbox_dump();
+        if (sd_dumping) save_sd_position(calib_sd.log_block); //the slot moved on
+        else if (sd_start(log_block)) save_sd_position(log_block + LOG_RESERVE_BLOCKS);
     }
 }
 
-ISR(TIMER0_COMPA_vect) { //pwm 1 off
-    if (abs_int(brushed_1_power) <= (255 - PWM_MARGIN)) { //i.e. if we don't want the signal snapped to always on
-        WRITE_PIN(BRUSHED_1_A_PORT, BRUSHED_1_A_PIN, 1);
-        WRITE_PIN(BRUSHED_1_B_PORT, BRUSHED_1_B_PIN, 1);
-    }
+static void voltage_task(void) { //about as often as the ADC has a new battery result
+    uint16_t mv = adc_battery_mv();
+    voltage = mv;
+    if (mv && mv < voltage_min) voltage_min = mv; //0 until the first ADC result
+    control_battery(mv);
 }
 
-ISR(TIMER0_COMPB_vect) { //pwm 2 off
-    if (abs_int(brushed_2_power) <= (255 - PWM_MARGIN)) { //i.e. if we don't want the signal snapped to always on
-        WRITE_PIN(BRUSHED_2_A_PORT, BRUSHED_2_A_PIN, 1);
-        WRITE_PIN(BRUSHED_2_B_PORT, BRUSHED_2_B_PIN, 1);
+static void button_task(void) { //slow enough to debounce
+    if (!READ_PIN(BUTTON_PORT, BUTTON_PIN)) {
+        if (button_held < BUTTON_HOLD_RUNS && ++button_held == BUTTON_HOLD_RUNS && !calib_active) {
+            calib_start(); //long press
+        }
+    } else {
+        if (button_held && button_held < BUTTON_HOLD_RUNS) { //short press, on release
+            if (calib_active) {
+                calib_finish();
+            } else {
+                page = (page + 1 < PAGES) ? page + 1 : PAGE_NORMAL;
+                page_label = PAGE_LABEL_RUNS;
+            }
+        }
+        button_held = 0;
     }
 }
 
-ISR(TIMER1_COMPA_vect) //timer 1 interrupt (7seg display)
-{
-    WRITE_PIN(DISP_DIGIT_1_PORT, DISP_DIGIT_1_PIN, 0);
-    WRITE_PIN(DISP_DIGIT_2_PORT, DISP_DIGIT_2_PIN, 0);
-    WRITE_PIN(DISP_DIGIT_3_PORT, DISP_DIGIT_3_PIN, 0);
-
-    switch(digit_index) { //each digit is active at 1/24 duty cycle, 1/24 out of phase from the other digits
-        case 1:
-            set_register(digit1);
-            WRITE_PIN(DISP_DIGIT_1_PORT, DISP_DIGIT_1_PIN, 1);
-            break;
-        case 2:
-            set_register(digit2);
-            WRITE_PIN(DISP_DIGIT_2_PORT, DISP_DIGIT_2_PIN, 1);
-            break;
-        case 3:
-            set_register(digit3);
-            WRITE_PIN(DISP_DIGIT_3_PORT, DISP_DIGIT_3_PIN, 1);
-            break;
-        case DISPLAY_DUTY_CYCLE:
-            digit_index = 0;
-            break;
+static inline uint8_t lowest_bit(uint8_t x) { //index of the lowest set bit, x must be nonzero
+    uint8_t i = 0;
+    while (!(x & 1)) {
+        x >>= 1;
+        i++;
     }
-    
-    //things that count up at 484 Hz
-    digit_index++; 
-    timer_counter++;
-    voltmeter_counter++;
-    orientation_counter++;
-
-    set_brushed_duty();
+    return i;
 }
 
-ISR(TIMER2_OVF_vect) { //sample pwm input pins
-    pulse_denominator_brushed += 1;
-    pulse_denominator_brushless += 1;
-
-    pulse_numerator_brushed[0] += READ_PIN(CTRL_1_A_PORT, CTRL_1_A_PIN);
-    pulse_numerator_brushed[1] += READ_PIN(CTRL_1_B_PORT, CTRL_1_B_PIN);
-    pulse_numerator_brushed[2] += READ_PIN(CTRL_2_A_PORT, CTRL_2_A_PIN);
-    pulse_numerator_brushed[3] += READ_PIN(CTRL_2_B_PORT, CTRL_2_B_PIN);
-    pulse_numerator_brushless += READ_PIN(CTRL_3_PORT, CTRL_3_PIN);
-
-    if (pulse_denominator_brushed >= BRUSHED_SAMPLE_LIMIT) { //find avg. rate of change of pulse_numerator_brushed over 120 interrupts, i.e. at 8000000/(256*120) = 260Hz
-        for (uint8_t i = 0; i < 4; i++) {
-            pulse_duty_cycle_brushed[i] = clip_0(clip_8(pulse_numerator_brushed[i]*255/BRUSHED_SAMPLE_LIMIT));
-            pulse_numerator_brushed[i] = 0;
-        }
+static inline uint16_t tenths_of_volt(uint16_t mv) {
+    return ((uint32_t)mv*656) >> 16; //656/65536 ~= 1/100
+}
 
-        pulse_denominator_brushed = 0;
+static uint16_t page_value(uint8_t p) {
+    switch (p) {
+        case PAGE_LOAD: return perf_load;
+        case PAGE_ISR_TICK: return TIMER1_US(read_counter16(&perf_isr_max[PERF_ISR_TICK]));
+        case PAGE_ISR_RX: return TIMER1_US(read_counter16(&perf_isr_max[PERF_ISR_RX]));
+        case PAGE_ISR_I2C: return TIMER1_US(read_counter16(&perf_isr_max[PERF_ISR_I2C]));
+        case PAGE_ISR_ADC: return TIMER1_US(read_counter16(&perf_isr_max[PERF_ISR_ADC]));
+        case PAGE_ISR_PWM: return TIMER1_US(read_counter16(&perf_isr_max[PERF_ISR_PWM]));
+        case PAGE_LOOP_HZ: return ((uint32_t)perf_loop_hz*6554) >> 16; //6554/65536 ~= 1/10
+        case PAGE_ACCEL_HZ: return perf_accel_hz;
+        case PAGE_I2C_NACKS: return accel_nacks;
+        case PAGE_I2C_TIMEOUTS: return i2c_timeouts;
+#if RX_PROTOCOL == RX_PWM
+        case PAGE_RX_ERRORS: return rx_fault_count;
+#else
+        case PAGE_RX_ERRORS: return read_counter16(&rx_serial_line_errors) + rx_serial_check_errors;
+#endif
+        case PAGE_VOLTAGE_MIN: return (voltage_min == 0xFFFF) ? 0 : tenths_of_volt(voltage_min);
     }
-    if (pulse_denominator_brushless >= BRUSHLESS_SAMPLE_LIMIT) { //find avg. rate of change of pulse_numerator_brushed over 625 interrupts, i.e. at 8000000/(256*625) = 50Hz
-        //48 counts (~8000000Hz*(1500*10^-6s)/(256)) = min, 63 counts (~8000000Hz*(2000*10^-6s)/(256)) = max
-        //since we're calculating unsigned input power directly, we want 0 = min, 255 = max
-        //the resolution is pretty bad (quantized to multiples of 17) so we might need to take a rolling avg.
-
-        brushless_power_in = (uint8_t)clip_8(((uint16_t)clip_0((int16_t)(pulse_numerator_brushless/2)-48)*255)/(62-48)); 
-        brushless_shutdown = pulse_numerator_brushless < 40;
+    return 0;
+}
 
-        pulse_numerator_brushless = 0;
-        pulse_denominator_brushless = 0;
+static void display_task(void) {
+    uint8_t faults = rx_faults;
+    uint8_t show_reset = reset_show != 0;
+    if (show_reset) reset_show--; //counts down behind calibration and the pages too, the code only shows once
+    if (calib_active) { //"C", channels learned so far
+        uint8_t n = 0;
+        for (uint8_t learned = calib_learned; learned; learned >>= 1) n += learned & 1;
+        set_digits_letter(DISPLAY_LETTER_C, n);
+    } else if (page_label) {
+        page_label--;
+        set_digits_letter(DISPLAY_LETTER_P, page);
+    } else if (page != PAGE_NORMAL) {
+        uint16_t v = page_value(page);
+        set_digits(v > 999 ? 999 : v);
+    } else if (show_reset) {
+        set_digits_letter(DISPLAY_LETTER_R, reset_cause);
+    } else if (faults) { //"F", channel (1-5), fault code
+        uint8_t ch = lowest_bit(faults);
+        set_digits_letter(DISPLAY_LETTER_F, (ch + 1)*10 + rx_fault[ch]);
+    } else if (!accel_ok) { //"A", restarts so far; driving carries on as if right side up
+        set_digits_letter(DISPLAY_LETTER_A, accel_restarts > 99 ? 99 : accel_restarts);
+    } else {
+        set_digits(tenths_of_volt(voltage));
     }
 }
 
-ISR(TIMER4_COMPA_vect) { //pwm 3 on
-    if (!brushless_shutdown) {
-        WRITE_PIN(BRUSHLESS_1_PORT, BRUSHLESS_1_PIN, 1);
-    }
+static inline uint8_t decode_reset(uint8_t mcusr) {
+    if (mcusr & (1 << PORF)) return RESET_POWER_ON; //may come with BORF as the supply rises
+    if (mcusr & (1 << WDRF)) return RESET_WATCHDOG;
+    if (mcusr & (1 << BORF)) return RESET_BROWN_OUT;
+    return RESET_EXTERNAL;
 }
 
-ISR(TIMER4_COMPB_vect) { //pwm 3 off
-    WRITE_PIN(BRUSHLESS_1_PORT, BRUSHLESS_1_PIN, 0);
+static inline uint16_t boot_time_us(void) { //timer 1 started counting at init_timer_1(), it wraps after 65536 counts
+    uint8_t sreg = SREG;
+    cli();
+    uint16_t now = TCNT1;
+    uint16_t ticks = sched_ticks;
+    SREG = sreg;
+    return (ticks >= 65536UL/SCHED_TICK_COUNTS) ? 0xFFFF : TIMER1_US(now);
 }
 
+static task_t tasks[] = { //period, phase in ticks
+    TASK(control_task, 1, 0),
+    TASK(i2c_poll, 1, 0),
+    TASK(accel_task, ACCEL_POLL_TICKS + 1, 0),
+    TASK(sd_task, 1, 0),
+    TASK(voltage_task, SCHED_MS(25), 3),
+    TASK(button_task, SCHED_MS(BUTTON_PERIOD_MS), 5),
+    TASK(display_task, SCHED_MS(DISPLAY_PERIOD_MS), 7),
+    TASK(calib_poll, SCHED_MS(4), 9),
+};
+
 int main(void) {
-    // set pin directions
-    //display
-    DDRx(DISP_SER_PORT) |= DISP_SER_PIN; // sets pin as output (if a pin is not set here it defaults to being an input)
-    DDRx(DISP_SRCLOCK_PORT) |= DISP_SRCLOCK_PIN;
-    DDRx(DISP_RCLOCK_PORT) |= DISP_RCLOCK_PIN;
-    DDRx(DISP_DIGIT_1_PORT) |= DISP_DIGIT_1_PIN;
-    DDRx(DISP_DIGIT_2_PORT) |= DISP_DIGIT_2_PIN;
-    DDRx(DISP_DIGIT_3_PORT) |= DISP_DIGIT_3_PIN;
-
-    //brushed motors
-    DDRx(BRUSHED_1_A_PORT) |= BRUSHED_1_A_PIN;
-    DDRx(BRUSHED_1_B_PORT) |= BRUSHED_1_B_PIN;
-    DDRx(BRUSHED_2_A_PORT) |= BRUSHED_2_A_PIN;
-    DDRx(BRUSHED_2_B_PORT) |= BRUSHED_2_B_PIN;
-
-    //brushless motor
-    DDRx(BRUSHLESS_1_PORT) |= BRUSHLESS_1_PIN;
+    //first thing: after a watchdog reset the watchdog is still running, at its 16 ms minimum
+    uint8_t mcusr = MCUSR;
+    MCUSR = 0;
+    wdt_enable(WDT_TIMEOUT);
+    reset_cause = decode_reset(mcusr);
+    reset_show = (reset_cause != RESET_POWER_ON) ? RESET_SHOW_RUNS : 0;
+
+    motor_init(); //the bridge and ESC pins float until now, brake / 0 power before anything slower
+    init_timer_1();
+    display_init();
+    calib_load(); //input ranges, tuning and SD positions, before anything reads them
+    blackbox_init(reset_cause == RESET_POWER_ON ? BLACKBOX_COLD :
+                  reset_cause == RESET_WATCHDOG ? BLACKBOX_WATCHDOG :
+                  reset_cause == RESET_BROWN_OUT ? BLACKBOX_BROWN_OUT : 0, calib_sd.blackbox_slot);
+    log_block = calib_sd.log_block;
 
     //button pullup
     WRITE_PIN(BUTTON_PORT, BUTTON_PIN, 1);
 
-    i2c_init();
+    i2c_init(); //also frees the bus if a reset caught the sensor mid-read
     adc_init();
-
-    init_timer_0();
-    init_timer_1();
-    init_timer_2();
-    init_timer_4();
+    rx_init();
+    sd_init();
     sei(); //enable all interrupts
 
-    set_brushed_duty();
-    set_brushless_duty();
-
-    voltage = get_battery_voltage();
-    set_digits(voltage);
-
-    uint8_t i2c_send_packet[2] = {CTRL1, CTRL1_VAL};
-    i2c_send(&i2c_send_packet[0], 2); //tell the accelerometer what register is being accessed
-
-    while(1) {
-        if (timer_counter > 5) {
-            timer_counter = 0;
-            
-            i2c_address = OUT_X_L;
-            i2c_send(&i2c_address, 1); //tell the accelerometer what register is being accessed
-            i2c_recv(&xyz, 6); //receive data from the register and assign the value to x_axis_h
-
-            downness = ((xyz[0]/1000)*xyz_down[0] + (xyz[1]/1000)*xyz_down[1] + (xyz[2]/1000)*xyz_down[2])/16;
-
-            if (downness <= -FLIP_DEADZONE) orientation_mult = -1; 
-            else if (downness >= FLIP_DEADZONE) orientation_mult = 1;
-            else orientation_mult = 0;
-
-            brushed_1_power = brushed_1_power_in*orientation_filtered;
-            brushed_2_power = brushed_2_power_in*orientation_filtered;
-            //brushless_power = brushless_power_in*orientation_filtered/5;
-            brushless_power = -(127*(brushless_power_in > 40) + 127*(brushless_power_in > 190))*orientation_filtered/5;
-
-            set_brushless_duty();
-
-            //set_digits_signed(orientation_filtered);
-        }
-        
-        if (orientation_filtered != orientation_mult) {
-            if (orientation_counter > FLIP_TIMEOUT) orientation_filtered = orientation_mult;
-        } else {
-            orientation_counter = 0;
-        }
-
-        if (voltmeter_counter > 20) { //once every 10 seconds or so
-            voltage = get_battery_voltage();
-            set_digits(voltage);
-            voltmeter_counter = 0;
-        }
-        
-        if (!READ_PIN(BUTTON_PORT, BUTTON_PIN)) {
-            set_digits(bubbles);
-        }
+    //retried until the sensor has had ACCEL_BOOT_MS to come up; without it the robot still drives, as if right side up
+    while (!(accel_ok = accel_init()) && read_counter16(&sched_ticks) < SCHED_MS(ACCEL_BOOT_MS)) {
+        wdt_reset();
     }
-}
\ No newline at end of file
+    accel_last_sample = read_counter16(&sched_ticks);
+
+    boot_us = boot_time_us();
+    sched_run(tasks, sizeof(tasks)/sizeof(tasks[0]));
+}
@@ -0,0 +1,304 @@
+#include "motor.h"
+#include "pins.h"
+#include "rx.h"
+#include "util.h"
+#include "shared.h"
+#include "tables.h"
+#include "perf.h"
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <stdint.h>
+
+volatile int16_t brushed_1_power = 0;
+volatile int16_t brushed_2_power = 0;
+volatile int16_t brushless_power = 0;
+
+#if BRUSHED_HW_PWM
+//both bridges run off 8-bit-wide PWM with identical timing: timer 0 natively, timer 3 with TOP = ICR3 = 255.
+//pick the fastest mode/prescaler whose carrier doesn't exceed BRUSHED_PWM_FREQ
+#if BRUSHED_PWM_FREQ < 1000 || BRUSHED_PWM_FREQ > 20000
+#error "BRUSHED_PWM_FREQ must be between 1000 and 20000 Hz"
+#endif
+
+#if BRUSHED_PWM_FREQ >= F_CPU/256
+#define BRUSHED_PWM_PHASE_CORRECT 0
+#define BRUSHED_PWM_PRESCALER 1
+#elif BRUSHED_PWM_FREQ >= F_CPU/510
+#define BRUSHED_PWM_PHASE_CORRECT 1
+#define BRUSHED_PWM_PRESCALER 1
+#elif BRUSHED_PWM_FREQ >= F_CPU/(256*8)
+#define BRUSHED_PWM_PHASE_CORRECT 0
+#define BRUSHED_PWM_PRESCALER 8
+#elif BRUSHED_PWM_FREQ >= F_CPU/(510*8)
+#define BRUSHED_PWM_PHASE_CORRECT 1
+#define BRUSHED_PWM_PRESCALER 8
+#elif BRUSHED_PWM_FREQ >= F_CPU/(256*64) //e.g. 1000-1959 Hz at 8 MHz, below what /8 can make, gets 488 Hz
+#define BRUSHED_PWM_PHASE_CORRECT 0
+#define BRUSHED_PWM_PRESCALER 64
+#elif BRUSHED_PWM_FREQ >= F_CPU/(510*64)
+#define BRUSHED_PWM_PHASE_CORRECT 1
+#define BRUSHED_PWM_PRESCALER 64
+#else
+#error "BRUSHED_PWM_FREQ is below every carrier this F_CPU can make"
+#endif
+
+#if BRUSHED_PWM_PRESCALER == 1
+#define BRUSHED_CS0 (1 << CS00)
+#define BRUSHED_CS3 (1 << CS30)
+#elif BRUSHED_PWM_PRESCALER == 8
+#define BRUSHED_CS0 (1 << CS01)
+#define BRUSHED_CS3 (1 << CS31)
+#else
+#define BRUSHED_CS0 ((1 << CS01) | (1 << CS00))
+#define BRUSHED_CS3 ((1 << CS31) | (1 << CS30))
+#endif
+
+#if BRUSHED_PWM_PHASE_CORRECT
+#define BRUSHED_OCR_OFFSET 0 //inverting phase correct mode holds the pin low for OCR/255
+#define BRUSHED_WGM0A (1 << WGM00) //mode 1, phase correct, TOP = 0xFF
+#define BRUSHED_WGM3A (1 << WGM31) //mode 10, phase correct, TOP = ICR3
+#define BRUSHED_WGM3B (1 << WGM33)
+#else
+#define BRUSHED_OCR_OFFSET 1 //inverting fast PWM holds the pin low for (OCR+1)/256
+#define BRUSHED_WGM0A ((1 << WGM01) | (1 << WGM00)) //mode 3, fast PWM, TOP = 0xFF
+#define BRUSHED_WGM3A (1 << WGM31) //mode 14, fast PWM, TOP = ICR3
+#define BRUSHED_WGM3B ((1 << WGM33) | (1 << WGM32))
+#endif
+
+//inverting compare output: the pin is low for the duty fraction and high (brake) otherwise,
+//the same drive/brake pattern the software PWM produces
+#define COM_A_INV(n) ((1 << COM##n##A1) | (1 << COM##n##A0))
+#define COM_B_INV(n) ((1 << COM##n##B1) | (1 << COM##n##B0))
+
+static inline void init_brushed_pwm(void) {
+    //with the compare output disconnected a pin falls back to its PORT bit, which stays 1 (brake)
+    WRITE_PINS(BRUSHED_PORT, BRUSHED_PINS, BRUSHED_PINS);
+
+    TCCR0A = BRUSHED_WGM0A; //bridge 1, outputs connected in set_brushed_duty()
+    TCCR0B = BRUSHED_CS0;
+    TIMSK0 = 0; //no interrupts, the compare unit drives the pins
+
+    ICR3 = 255;
+    TCCR3A = BRUSHED_WGM3A; //bridge 2
+    TCCR3B = BRUSHED_WGM3B | BRUSHED_CS3;
+}
+
+//the pin that is pulled low selects the direction, so each bridge connects at most one compare output at a time
+static inline uint8_t bridge_com(int16_t power, uint8_t com_a, uint8_t com_b) {
+    if (power > 0) return com_a;
+    if (power < 0) return com_b;
+    return 0;
+}
+
+void set_brushed_duty(void) {
+    int16_t p1 = brushed_1_power;
+    int16_t p2 = brushed_2_power;
+    uint8_t duty_1 = (uint8_t)(abs_int(p1) - BRUSHED_OCR_OFFSET);
+    uint8_t duty_2 = (uint8_t)(abs_int(p2) - BRUSHED_OCR_OFFSET);
+
+    OCR0A = duty_1;
+    OCR0B = duty_1;
+    uint8_t sreg = SREG;
+    cli(); //a 16-bit write goes through timer 3's TEMP byte, nothing else may touch timer 3 in between
+    OCR3A = duty_2;
+    OCR3B = duty_2;
+    SREG = sreg;
+
+    uint8_t com_1 = bridge_com(p1, COM_A_INV(0), COM_B_INV(0));
+    uint8_t com_2 = bridge_com(p2, COM_A_INV(3), COM_B_INV(3));
+    if ((TCCR0A & ~BRUSHED_WGM0A) != com_1) TCCR0A = BRUSHED_WGM0A | com_1; //only touch the mode on a direction change
+    if ((TCCR3A & ~BRUSHED_WGM3A) != com_2) TCCR3A = BRUSHED_WGM3A | com_2;
+}
+
+#else
+#define PWM_MARGIN 1 //if the motor power is within margin of 0 or 255, it will snap to 0 or 255 so the interrupts don't overlap
+
+//timer 0 counts 0-255 in normal mode, the prescaler sets the carrier
+#if F_CPU/(256UL*8) <= BRUSHED_SW_PWM_FREQ
+#define BRUSHED_SW_CS0 (1 << CS01)
+#elif F_CPU/(256UL*64) <= BRUSHED_SW_PWM_FREQ
+#define BRUSHED_SW_CS0 ((1 << CS01) | (1 << CS00))
+#elif F_CPU/(256UL*256) <= BRUSHED_SW_PWM_FREQ
+#define BRUSHED_SW_CS0 (1 << CS02)
+#else
+#error "BRUSHED_SW_PWM_FREQ is below every carrier this F_CPU can make"
+#endif
+
+//port patterns for both bridges, worked out in main so each interrupt is a single write to BRUSHED_PORT
+typedef struct {
+    uint8_t drive_mask; //bridge pins set at overflow, a bridge snapped to always off is left out
+    uint8_t drive; //their levels: the pin on the side of the direction low, the other high
+    uint8_t brake_1; //bridge 1 pins raised at compare A, 0 if snapped to always on
+    uint8_t brake_2; //bridge 2 pins raised at compare B
+} brushed_out_t;
+
+//the timer 0 interrupts read the patterns, main publishes them whole so a byte can't change mid-read
+static DOUBLE_BUFFER(brushed_out_t) brushed_out;
+
+static inline void init_brushed_pwm(void) { //brushed motor PWM timer
+    TCCR0A = 0; //waveform generation mode set to normal (clear timer on overflow) 
+    TCCR0B = BRUSHED_SW_CS0; //F_CPU/(256*prescaler), at most BRUSHED_SW_PWM_FREQ
+    TIMSK0 = (1 << OCIE0A) | (1 << OCIE0B) | (1 << TOIE0); //interrupt enabled for timer output compare match A and B, and for timer overflow
+    OCR0A = 0; //output compare match A when the timer counts up to this value
+    OCR0B = 0; //output compare match B when the timer counts up to this value
+}
+
+static inline uint8_t bridge_drive(int16_t power, uint8_t pin_a, uint8_t pin_b) {
+    return (power < 0) ? pin_a : pin_b; //power < 0 raises A, power > 0 raises B
+}
+
+void set_brushed_duty(void) {
+    int16_t p1 = brushed_1_power;
+    int16_t p2 = brushed_2_power;
+    uint8_t duty_1 = (uint8_t)abs_int(p1);
+    uint8_t duty_2 = (uint8_t)abs_int(p2);
+    brushed_out_t out = {0, 0, 0, 0};
+
+    if (duty_1 >= PWM_MARGIN) { //i.e. if we don't want the signal snapped to always off
+        out.drive_mask |= BRUSHED_1_PINS;
+        out.drive |= bridge_drive(p1, BRUSHED_1_A_PIN, BRUSHED_1_B_PIN);
+    }
+    if (duty_2 >= PWM_MARGIN) {
+        out.drive_mask |= BRUSHED_2_PINS;
+        out.drive |= bridge_drive(p2, BRUSHED_2_A_PIN, BRUSHED_2_B_PIN);
+    }
+    if (duty_1 <= (255 - PWM_MARGIN)) out.brake_1 = BRUSHED_1_PINS; //i.e. if we don't want the signal snapped to always on
+    if (duty_2 <= (255 - PWM_MARGIN)) out.brake_2 = BRUSHED_2_PINS;
+
+    DOUBLE_BUFFER_PUBLISH(brushed_out, out);
+    OCR0A = duty_1;
+    OCR0B = duty_2;
+}
+
+//each bridge goes from brake straight to drive and back in one write, never through a state with only one pin changed
+ISR(TIMER0_OVF_vect) { //pwm 1 and 2 on
+    PERF_ISR_BEGIN();
+    const brushed_out_t* out = &DOUBLE_BUFFER_FRONT(brushed_out);
+    WRITE_PINS(BRUSHED_PORT, out->drive_mask, out->drive);
+    PERF_ISR_END(PERF_ISR_PWM);
+}
+
+ISR(TIMER0_COMPA_vect) { //pwm 1 off
+    PERF_ISR_BEGIN();
+    uint8_t brake = DOUBLE_BUFFER_FRONT(brushed_out).brake_1;
+    TOGGLE_PINS(BRUSHED_PORT, ~PORTx(BRUSHED_PORT) & brake); //raise whichever pin is low
+    PERF_ISR_END(PERF_ISR_PWM);
+}
+
+ISR(TIMER0_COMPB_vect) { //pwm 2 off
+    PERF_ISR_BEGIN();
+    uint8_t brake = DOUBLE_BUFFER_FRONT(brushed_out).brake_2;
+    TOGGLE_PINS(BRUSHED_PORT, ~PORTx(BRUSHED_PORT) & brake);
+    PERF_ISR_END(PERF_ISR_PWM);
+}
+#endif
+
+//brushless ESC frame on timer 4, mode 15 (fast PWM, TOP = OCR4A) so OCR4A/OCR4B are double buffered
+//and a pulse width change never lands mid-pulse.
+//BRUSHLESS_HW_PULSE: the ESC is on OC4B, the compare unit sets it at BOTTOM and clears it at OCR4B, so the
+//width is exact to the timer clock; the compare B interrupt only connects or disconnects the pin for the next frame.
+//otherwise the pin isn't a compare output: the overflow interrupt raises it and compare B drops it. each edge
+//waits for whatever interrupt is running when it comes due (the display/tick interrupt is the longest, see
+//isrcheck.py), and the two waits are independent, so the width jitters by up to the longest handler plus the
+//7-cycle entry, tens of us at 8 MHz. fine for PWM50/PWM400 (1000 us range), a large share of OneShot125's 125 us
+#if BRUSHLESS_PROTOCOL == BRUSHLESS_ONESHOT125
+#define BRUSHLESS_PRESCALER 1
+#define BRUSHLESS_CS (1 << CS40)
+#define BRUSHLESS_FRAME_US 1000 //1 kHz
+#define BRUSHLESS_MIN_US 125
+#define BRUSHLESS_MAX_US 250
+#define BRUSHLESS_TABLE esc_oneshot125
+#else
+#define BRUSHLESS_PRESCALER 8
+#define BRUSHLESS_CS (1 << CS41)
+#if BRUSHLESS_PROTOCOL == BRUSHLESS_PWM400
+#define BRUSHLESS_FRAME_US 2500 //400 Hz
+#define BRUSHLESS_TABLE esc_pwm400
+#else
+#define BRUSHLESS_FRAME_US 20000 //50 Hz
+#define BRUSHLESS_TABLE esc_pwm50
+#endif
+#define BRUSHLESS_MIN_US 1000
+#define BRUSHLESS_MAX_US 2000
+#endif
+
+#define BRUSHLESS_TICKS(us) ((F_CPU/1000000UL)*(us)/BRUSHLESS_PRESCALER) //timer 4 counts for a time in us
+#define BRUSHLESS_CENTER ((uint16_t)((BRUSHLESS_TICKS(BRUSHLESS_MIN_US) + BRUSHLESS_TICKS(BRUSHLESS_MAX_US))/2)) //pulse for 0 power
+
+#if BRUSHLESS_TICKS(BRUSHLESS_FRAME_US) > 65536
+#error "brushless frame doesn't fit in timer 4 at this F_CPU"
+#endif
+
+#if TABLES_F_CPU != F_CPU
+#error "tables.h was generated for another F_CPU, check TABLE_OPTS in the Makefile"
+#endif
+
+#define BRUSHLESS_WGM4A ((1 << WGM41) | (1 << WGM40))
+#define BRUSHLESS_COM (1 << COM4B1) //non-inverting: set at BOTTOM, cleared on compare match
+
+static inline void init_timer_4(void) { //brushless motor PWM timer
+    TCCR4A = BRUSHLESS_WGM4A; //waveform generation mode 15, fast PWM with TOP = OCR4A
+    TCCR4B = (1 << WGM43) | (1 << WGM42) | BRUSHLESS_CS;
+#if BRUSHLESS_HW_PULSE
+    TIMSK4 = (1 << OCIE4B); //interrupt enabled for output compare match B (pulse end, the output for the next frame)
+#else
+    TIMSK4 = (1 << TOIE4) | (1 << OCIE4B); //interrupt enabled for timer overflow (pulse start) and output compare match B (pulse end)
+#endif
+    OCR4A = BRUSHLESS_TICKS(BRUSHLESS_FRAME_US) - 1; //frame period
+    OCR4B = BRUSHLESS_CENTER;
+}
+
+void set_brushless_duty(void) {
+    //-255..255 maps onto the protocol's min..max pulse, e.g. 1000-2000 us for PWM, the table holds the half above center
+    int16_t power = brushless_power;
+    uint8_t mag = clip_8((power < 0) ? -power : power);
+    uint16_t offset = pgm_read_word(&BRUSHLESS_TABLE[mag]);
+    uint16_t pulse = (power < 0) ? BRUSHLESS_CENTER - offset : BRUSHLESS_CENTER + offset;
+
+    uint8_t sreg = SREG;
+    cli(); //a 16-bit write goes through timer 4's TEMP byte, nothing else may touch timer 4 in between
+    OCR4B = pulse;
+    SREG = sreg;
+}
+
+#if BRUSHLESS_HW_PULSE
+ISR(TIMER4_COMPB_vect) { //pwm 3 just ended, the pin is low: connect it for the next frame unless shut down
+    PERF_ISR_BEGIN();
+    //with the compare output disconnected the pin falls back to its PORT bit, which stays 0
+    TCCR4A = brushless_shutdown ? BRUSHLESS_WGM4A : BRUSHLESS_WGM4A | BRUSHLESS_COM;
+    PERF_ISR_END(PERF_ISR_PWM);
+}
+#else
+ISR(TIMER4_OVF_vect) { //pwm 3 on
+    PERF_ISR_BEGIN();
+    if (!brushless_shutdown) {
+        WRITE_PIN(BRUSHLESS_1_PORT, BRUSHLESS_1_PIN, 1);
+    }
+    PERF_ISR_END(PERF_ISR_PWM);
+}
+
+ISR(TIMER4_COMPB_vect) { //pwm 3 off
+    PERF_ISR_BEGIN();
+    WRITE_PIN(BRUSHLESS_1_PORT, BRUSHLESS_1_PIN, 0);
+    PERF_ISR_END(PERF_ISR_PWM);
+}
+#endif
+
+void motor_init(void) {
+    //brushed motors
+    PIN_GROUP_CHECK(BRUSHED_PORT, BRUSHED_1_A_PORT);
+    PIN_GROUP_CHECK(BRUSHED_PORT, BRUSHED_1_B_PORT);
+    PIN_GROUP_CHECK(BRUSHED_PORT, BRUSHED_2_A_PORT);
+    PIN_GROUP_CHECK(BRUSHED_PORT, BRUSHED_2_B_PORT);
+    DDRx(BRUSHED_PORT) |= BRUSHED_PINS;
+
+    //brushless motor
+    DDRx(BRUSHLESS_1_PORT) |= BRUSHLESS_1_PIN;
+
+    init_brushed_pwm();
+    init_timer_4();
+
+    set_brushed_duty();
+    set_brushless_duty();
+}
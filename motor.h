@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdint.h>
+#include "pins.h" //BRUSHED_HW_PWM selects the pin map
+
+//brushless ESC protocols
+#define BRUSHLESS_PWM50 0 //standard servo PWM, 1000-2000 us pulse at 50 Hz
+#define BRUSHLESS_PWM400 1 //1000-2000 us pulse at 400 Hz
+#define BRUSHLESS_ONESHOT125 2 //125-250 us pulse at 1 kHz
+
+#define BRUSHLESS_PROTOCOL BRUSHLESS_PWM50 //must be supported by the weapon ESC
+
+#define BRUSHED_PWM_FREQ 16000 //target carrier in Hz for BRUSHED_HW_PWM, 1000 to 20000; the nearest achievable rate at or below it is used
+#define BRUSHED_SW_PWM_FREQ 1250 //same for the software PWM (three interrupts per period): 488 Hz at 8 MHz, 976 at 16, 1220 at 20
+
+extern volatile int16_t brushed_1_power; //-255 to 255 (+ is in the direction given by right hand rule with thumb matching shaft, - is opposite)
+extern volatile int16_t brushed_2_power; //-255 to 255 (+ is in the direction given by right hand rule with thumb matching shaft, - is opposite)
+extern volatile int16_t brushless_power; //-255 to 255
+
+void motor_init(void); //pin directions and PWM timers, outputs start at 0 power
+void set_brushed_duty(void); //call every time brushed_#_power changes
+void set_brushless_duty(void); //call every time brushless_power changes
@@ -0,0 +1,38 @@
+#include "perf.h"
+#include "sched.h"
+#include <stdint.h>
+
+volatile uint16_t perf_isr_max[PERF_ISRS];
+volatile uint16_t perf_isr_counts = 0;
+uint8_t perf_load = 0;
+uint16_t perf_loop_hz = 0;
+uint16_t perf_accel_hz = 0;
+uint16_t perf_accel_samples = 0;
+
+static uint16_t window_start = 0;
+static uint16_t loops = 0;
+static uint32_t idle = 0; //timer 1 counts
+
+//per-window counts to per second, and average idle counts per tick to percent, as multiplies by 2^16 fractions
+#define PERF_HZ_SCALE ((uint16_t)(65536*1000000ULL/((uint32_t)SCHED_TICK_US << PERF_WINDOW_SHIFT)))
+#define PERF_LOAD_SCALE ((uint16_t)(65536UL*100/SCHED_TICK_COUNTS))
+
+void perf_idle(uint16_t counts) {
+    idle += counts;
+}
+
+void perf_loop(uint16_t tick) {
+    loops++;
+    if ((uint16_t)(tick - window_start) < (1U << PERF_WINDOW_SHIFT)) return;
+    window_start = tick;
+
+    uint16_t per_tick = idle >> PERF_WINDOW_SHIFT; //at most SCHED_TICK_COUNTS
+    if (per_tick > SCHED_TICK_COUNTS) per_tick = SCHED_TICK_COUNTS;
+    perf_load = 100 - (uint8_t)(((uint32_t)per_tick*PERF_LOAD_SCALE + 0x8000) >> 16);
+    perf_loop_hz = ((uint32_t)loops*PERF_HZ_SCALE + 0x8000) >> 16;
+    perf_accel_hz = ((uint32_t)perf_accel_samples*PERF_HZ_SCALE + 0x8000) >> 16;
+
+    idle = 0;
+    loops = 0;
+    perf_accel_samples = 0;
+}
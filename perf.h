@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+#include <avr/io.h>
+#include "sched.h"
+
+//runtime counters for the display pages (main.c): CPU load from the time the main loop sleeps, the longest run
+//of each interrupt group in timer 1 counts (TIMER1_US() converts), and the main loop and accelerometer rates. load and rates are
+//published once per window, the interrupt maxima are since boot
+#define PERF_ISR_TIMING 1 //0 drops the timer reads from the interrupts
+#define PERF_WINDOW_SHIFT 10 //2^10 ticks, about 1.06 s
+
+//interrupt groups for PERF_ISR_END()
+#define PERF_ISR_TICK 0 //TIMER1_COMPA: display refresh and scheduler tick
+#define PERF_ISR_RX 1 //PCINT2, PCINT3, USART0_RX
+#define PERF_ISR_I2C 2 //TWI0
+#define PERF_ISR_ADC 3
+#define PERF_ISR_PWM 4 //TIMER0 (software brushed PWM), TIMER4 (ESC pulse)
+#define PERF_ISRS 5
+
+extern volatile uint16_t perf_isr_max[PERF_ISRS]; //timer 1 counts, only grows, so read_counter16() reads it safely
+extern volatile uint16_t perf_isr_counts; //timer 1 counts spent in the timed interrupts, wraps; taken off the main loop's sleep
+extern uint8_t perf_load; //percent of the last window spent in tasks and interrupts, the interrupt entry and exit aside
+                          //(with PERF_ISR_TIMING 0, interrupts that fire while the main loop sleeps count as idle)
+extern uint16_t perf_loop_hz; //main loop passes per second, every interrupt wakes it for one
+extern uint16_t perf_accel_hz; //accelerometer samples per second
+extern uint16_t perf_accel_samples; //counted by the caller of control_sample()
+
+#if PERF_ISR_TIMING
+//first and last thing in a handler: the entry and exit (register saves) aren't counted, and the
+//handler must not return in between
+#define PERF_ISR_BEGIN() uint16_t perf_start_ = SCHED_TIMER
+#define PERF_ISR_END(group) do { \
+    uint16_t perf_counts_ = SCHED_TIMER - perf_start_; \
+    if (perf_counts_ > perf_isr_max[group]) perf_isr_max[group] = perf_counts_; \
+    perf_isr_counts += perf_counts_; \
+    } while (0)
+#else
+#define PERF_ISR_BEGIN() do {} while (0)
+#define PERF_ISR_END(group) do {} while (0)
+#endif
+
+void perf_loop(uint16_t tick); //once per main loop pass, closes the window when it is due
+void perf_idle(uint16_t counts); //timer 1 counts the main loop slept, less the interrupts that ran meanwhile
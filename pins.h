@@ -6,6 +6,17 @@
 #define PINx(p) (*(&p-2))
 #define PORTx(p) p
 
+#define BRUSHED_HW_PWM 0 //1: H-bridge inputs wired to the timer 0 / timer 3 compare outputs (alternate pin map below)
+#define BRUSHLESS_HW_PULSE 0 //1: ESC wired to OC4B (PD2) so timer 4 makes the pulse edges, receiver input 2A moves to PE1
+
+#if BRUSHLESS_HW_PULSE && BRUSHED_HW_PWM
+#error "PD2 is OC3B in the BRUSHED_HW_PWM map, BRUSHLESS_HW_PULSE needs it for OC4B"
+#endif
+
+#ifndef CLOCK_XTAL
+#define CLOCK_XTAL 0 //1: crystal on PB6/PB7 (XTAL1/XTAL2), set by the Makefile's CLOCK profile
+#endif
+
 //display pins
 #define DISP_SER_PORT PORTB
 #define DISP_SER_PIN (1<<4)
@@ -26,6 +37,19 @@
 #define DISP_DIGIT_3_PIN (1<<0)
 
 //brushed motor pins
+#if BRUSHED_HW_PWM
+#define BRUSHED_1_A_PORT PORTD //OC0A
+#define BRUSHED_1_A_PIN (1<<6)
+
+#define BRUSHED_1_B_PORT PORTD //OC0B
+#define BRUSHED_1_B_PIN (1<<5)
+
+#define BRUSHED_2_A_PORT PORTD //OC3A
+#define BRUSHED_2_A_PIN (1<<0)
+
+#define BRUSHED_2_B_PORT PORTD //OC3B
+#define BRUSHED_2_B_PIN (1<<2)
+#else
 #define BRUSHED_1_A_PORT PORTD
 #define BRUSHED_1_A_PIN (1<<4)
 
@@ -37,23 +61,57 @@
 
 #define BRUSHED_2_B_PORT PORTD
 #define BRUSHED_2_B_PIN (1<<7)
+#endif
+
+//both bridges form one pin group so a state change is a single port write, every brushed output must be on this port
+#define BRUSHED_PORT PORTD
+#define BRUSHED_1_PINS (BRUSHED_1_A_PIN | BRUSHED_1_B_PIN)
+#define BRUSHED_2_PINS (BRUSHED_2_A_PIN | BRUSHED_2_B_PIN)
+#define BRUSHED_PINS (BRUSHED_1_PINS | BRUSHED_2_PINS)
 
 //brushless motor pins
+#if BRUSHLESS_HW_PULSE
+#define BRUSHLESS_1_PORT PORTD //OC4B
+#define BRUSHLESS_1_PIN (1<<2)
+#elif CLOCK_XTAL
+#define BRUSHLESS_1_PORT PORTE //PB6 is XTAL1 with a crystal
+#define BRUSHLESS_1_PIN (1<<1)
+#else
 #define BRUSHLESS_1_PORT PORTB
 #define BRUSHLESS_1_PIN (1<<6)
+#endif
+
+//motor control inputs (from receiver), all brushed inputs must be on PORTD except CTRL_2_A with BRUSHLESS_HW_PULSE
+#if BRUSHED_HW_PWM
+#define CTRL_1_A_PORT PORTD //brushed 1, PCINT20
+#define CTRL_1_A_PIN (1<<4)
+
+#define CTRL_1_B_PORT PORTD //PCINT17
+#define CTRL_1_B_PIN (1<<1)
+
+#define CTRL_2_A_PORT PORTD //brushed 2, PCINT23
+#define CTRL_2_A_PIN (1<<7)
 
-//motor control inputs (from receiver)
+#define CTRL_2_B_PORT PORTD //PCINT19
+#define CTRL_2_B_PIN (1<<3)
+#else
 #define CTRL_1_A_PORT PORTD //brushed 1, PCINT16
 #define CTRL_1_A_PIN (1<<0)
 
 #define CTRL_1_B_PORT PORTD //PCINT17
 #define CTRL_1_B_PIN (1<<1)
 
+#if BRUSHLESS_HW_PULSE
+#define CTRL_2_A_PORT PORTE //brushed 2, PCINT25; PD2 is the ESC output
+#define CTRL_2_A_PIN (1<<1)
+#else
 #define CTRL_2_A_PORT PORTD //brushed 2, PCINT18
 #define CTRL_2_A_PIN (1<<2)
+#endif
 
 #define CTRL_2_B_PORT PORTD //PCINT19
 #define CTRL_2_B_PIN (1<<3)
+#endif
 
 #define CTRL_3_PORT PORTE //brushless 1, PCINT24
 #define CTRL_3_PIN (1<<0)
@@ -75,6 +133,21 @@
 #define BATTERY_VOLTAGE_PORT PORTC
 #define BATTERY_VOLTAGE_PIN (1<<3)
 
+//accelerometer INT1 (fifo threshold), optional; leave undefined if not wired and the fifo status is polled instead
+//#define ACCEL_INT_PORT PORTE
+//#define ACCEL_INT_PIN (1<<1)
+
+#if (CLOCK_XTAL || BRUSHLESS_HW_PULSE) && defined(ACCEL_INT_PORT)
+#error "PE1 is the ESC output (crystal map) or receiver input 2A (BRUSHLESS_HW_PULSE), move ACCEL_INT to a free pin and remove this check"
+#endif
+
+//accelerometer i2c, fixed by TWI0; only driven directly to clock a stuck bus free (i2c_recover())
+#define I2C_SDA_PORT PORTC
+#define I2C_SDA_PIN (1<<4)
+
+#define I2C_SCL_PORT PORTC
+#define I2C_SCL_PIN (1<<5)
+
 //button pin
 #define BUTTON_PORT PORTC
 #define BUTTON_PIN (1<<2)
@@ -84,4 +157,16 @@
     else PORTx(port) &= ~(pin); \
     } while (0)
 
-#define READ_PIN(port, pin) (!!(PINx(port) & (pin)))
\ No newline at end of file
+#define READ_PIN(port, pin) (!!(PINx(port) & (pin)))
+
+//pin groups: several pins on one port changed by one write, so they all switch on the same clock cycle.
+//writing a 1 to a PINx bit toggles that PORTx bit, so the write only touches the pins in mask
+#define WRITE_PINS(port, mask, value) (PINx(port) = (PORTx(port) ^ (value)) & (mask)) //set the pins in mask to the matching bits of value
+#define TOGGLE_PINS(port, mask) (PINx(port) = (mask))
+
+//compile time check that a pin belongs to the port of its group. the comparison folds to a constant,
+//so the call (and the error) only survives when the ports differ; needs optimization enabled
+void pin_group_port_mismatch(void) __attribute__((error("pin group spans more than one port, check pins.h")));
+#define PIN_GROUP_CHECK(group_port, port) do { \
+    if (&PORTx(group_port) != &PORTx(port)) pin_group_port_mismatch(); \
+    } while (0)
@@ -0,0 +1,318 @@
+#include "rx.h"
+#include "pins.h"
+#include "util.h"
+#include "shared.h"
+#include "rx_serial.h"
+#include "tables.h"
+#include "perf.h"
+#include "sched.h"
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <stdint.h>
+
+rx_range_t rx_range[RX_CHANNELS] = { //brushed: the full duty cycle, brushless: center to max
+    {0, 255, RX_SCALE(255)}, {0, 255, RX_SCALE(255)}, {0, 255, RX_SCALE(255)}, {0, 255, RX_SCALE(255)},
+    {RX_BRUSHLESS_CENTER_US, RX_BRUSHLESS_MAX_US - RX_BRUSHLESS_CENTER_US, RX_SCALE(RX_BRUSHLESS_MAX_US - RX_BRUSHLESS_CENTER_US)}
+};
+uint16_t rx_width_min = RX_BRUSHLESS_VALID_US;
+uint16_t rx_width_max = RX_BRUSHLESS_PULSE_MAX_US;
+uint16_t rx_raw[RX_CHANNELS];
+
+volatile uint8_t pulse_duty_cycle_brushed[4];
+volatile uint8_t brushless_power_in = 0;
+volatile uint8_t brushless_shutdown = 1;
+
+#if RX_PROTOCOL == RX_PWM
+volatile uint8_t rx_faults = 1 << RX_BRUSHLESS; //the weapon waits for RX_RECOVER_PULSES valid pulses after power up
+volatile uint8_t rx_fault[RX_CHANNELS] = {RX_OK, RX_OK, RX_OK, RX_OK, RX_FAULT_LOST};
+#else
+volatile uint8_t rx_faults = (1 << RX_CHANNELS) - 1; //everything waits for RX_RECOVER_PULSES valid frames
+volatile uint8_t rx_fault[RX_CHANNELS] = {RX_FAULT_LOST, RX_FAULT_LOST, RX_FAULT_LOST, RX_FAULT_LOST, RX_FAULT_LOST};
+#endif
+volatile uint16_t rx_fault_count = 0;
+volatile uint16_t rx_worst_loss_us = 0;
+
+static uint8_t good[RX_CHANNELS]; //valid pulses in a row, up to RX_RECOVER_PULSES
+
+//16-bit timestamps: a frame must fit, and a lost signal must be seen (rx_update() every tick) before its age wraps
+_Static_assert(TIMER1_FITS(RX_FAILSAFE_MAX_US + SCHED_TICK_US), "RX_FAILSAFE_MAX_US too long for timer 1 at this F_CPU");
+#define FAILSAFE_MIN TIMER1_COUNTS(RX_FAILSAFE_MIN_US)
+#define FAILSAFE_MAX TIMER1_COUNTS(RX_FAILSAFE_MAX_US)
+
+static inline uint16_t timer_now(void) {
+    uint8_t sreg = SREG;
+    cli(); //the pin change and tick interrupts read TCNT1 through the same timer 1 TEMP byte
+    uint16_t t = RX_TIMER;
+    SREG = sreg;
+    return t;
+}
+
+static void cut(uint8_t ch, uint8_t fault) {
+    uint8_t bit = 1 << ch;
+    good[ch] = 0;
+    rx_fault[ch] = fault;
+    if (!(rx_faults & bit)) rx_fault_count++;
+    rx_faults |= bit;
+}
+
+static inline uint8_t scale_reading(uint8_t ch, uint16_t reading) {
+    const rx_range_t* r = &rx_range[ch];
+    rx_raw[ch] = reading;
+    uint16_t above = clip_0((int16_t)(reading - r->zero));
+    if (above > r->span) above = r->span;
+    uint8_t x = clip_8((above*r->scale) >> 8);
+    return pgm_read_byte((ch == RX_BRUSHLESS) ? &weapon_curve[x] : &drive_curve[x]); //deadband and expo, TABLE_OPTS
+}
+
+static inline void cut_pairs(void) {
+    //a pair drives one bridge as A - B, so losing either half would leave the other driving alone
+    if (rx_faults & 0x03) pulse_duty_cycle_brushed[0] = pulse_duty_cycle_brushed[1] = 0;
+    if (rx_faults & 0x0C) pulse_duty_cycle_brushed[2] = pulse_duty_cycle_brushed[3] = 0;
+}
+
+#if RX_PROTOCOL == RX_PWM
+//CTRL_1_A to CTRL_2_B must be on PORTD (PCINT16-23), CTRL_3 on PORTE (PCINT24-27);
+//with BRUSHLESS_HW_PULSE, CTRL_2_A is on PORTE as well
+
+#if BRUSHLESS_HW_PULSE
+#define RX_PORTD_MASK (CTRL_1_A_PIN | CTRL_1_B_PIN | CTRL_2_B_PIN)
+#define RX_PORTE_MASK (CTRL_2_A_PIN | CTRL_3_PIN)
+#else
+#define RX_PORTD_MASK (CTRL_1_A_PIN | CTRL_1_B_PIN | CTRL_2_A_PIN | CTRL_2_B_PIN)
+#define RX_PORTE_MASK (CTRL_3_PIN)
+#endif
+
+typedef struct { //written in the pin change interrupts, times in timer 1 counts
+    uint16_t rise_time;
+    uint16_t edge_time; //last edge of either polarity
+    uint16_t high_time; //width of the last complete pulse
+    uint16_t period; //rising edge to rising edge
+    uint8_t pulses; //completed pulses, wraps
+} rx_channel_t;
+
+static volatile rx_channel_t channel[RX_CHANNELS];
+static volatile uint8_t rx_seq = 0; //bumped at the end of every pin change interrupt, see SNAPSHOT_READ
+static uint8_t pulses_seen[RX_CHANNELS]; //main's copy of pulses at the last rx_update
+
+static uint8_t last_portd = 0;
+static uint8_t last_porte = 0;
+static uint8_t stale = (1 << RX_CHANNELS) - 1; //bit per channel, no edges within the channel's timeout (none yet at power up)
+static uint16_t timeout[RX_CHANNELS] = { //counts without an edge before the channel counts as static/lost
+    FAILSAFE_MAX, FAILSAFE_MAX, FAILSAFE_MAX, FAILSAFE_MAX, FAILSAFE_MAX
+};
+
+static inline void edge(uint8_t ch, uint8_t pin, uint8_t level, uint8_t changed, uint16_t now) {
+    if (!(changed & pin)) return;
+
+    volatile rx_channel_t* c = &channel[ch];
+    c->edge_time = now;
+    if (level & pin) {
+        c->period = now - c->rise_time;
+        c->rise_time = now;
+    } else {
+        c->high_time = now - c->rise_time;
+        c->pulses++;
+    }
+}
+
+ISR(PCINT2_vect) { //brushed inputs
+    PERF_ISR_BEGIN();
+    uint16_t now = RX_TIMER;
+    uint8_t level = PINx(CTRL_1_A_PORT) & RX_PORTD_MASK;
+    uint8_t changed = level ^ last_portd;
+    last_portd = level;
+
+    edge(0, CTRL_1_A_PIN, level, changed, now);
+    edge(1, CTRL_1_B_PIN, level, changed, now);
+#if !BRUSHLESS_HW_PULSE
+    edge(2, CTRL_2_A_PIN, level, changed, now);
+#endif
+    edge(3, CTRL_2_B_PIN, level, changed, now);
+    rx_seq++;
+    PERF_ISR_END(PERF_ISR_RX);
+}
+
+ISR(PCINT3_vect) { //brushless input (and brushed 2A with BRUSHLESS_HW_PULSE)
+    PERF_ISR_BEGIN();
+    uint16_t now = RX_TIMER;
+    uint8_t level = PINx(CTRL_3_PORT) & RX_PORTE_MASK;
+    uint8_t changed = level ^ last_porte;
+    last_porte = level;
+
+#if BRUSHLESS_HW_PULSE
+    edge(2, CTRL_2_A_PIN, level, changed, now);
+#endif
+    edge(RX_BRUSHLESS, CTRL_3_PIN, level, changed, now);
+    rx_seq++;
+    PERF_ISR_END(PERF_ISR_RX);
+}
+
+void rx_init(void) {
+    last_portd = PINx(CTRL_1_A_PORT) & RX_PORTD_MASK;
+    last_porte = PINx(CTRL_3_PORT) & RX_PORTE_MASK;
+
+    PCMSK2 = RX_PORTD_MASK;
+    PCMSK3 = RX_PORTE_MASK;
+    PCICR = (1 << PCIE2) | (1 << PCIE3); //pin change interrupts for PORTD and PORTE
+}
+
+static inline uint8_t level_of(uint8_t ch) { //current pin state, used when the input stops toggling
+    switch (ch) {
+        case 0: return READ_PIN(CTRL_1_A_PORT, CTRL_1_A_PIN);
+        case 1: return READ_PIN(CTRL_1_B_PORT, CTRL_1_B_PIN);
+        case 2: return READ_PIN(CTRL_2_A_PORT, CTRL_2_A_PIN);
+        case 3: return READ_PIN(CTRL_2_B_PORT, CTRL_2_B_PIN);
+        default: return READ_PIN(CTRL_3_PORT, CTRL_3_PIN);
+    }
+}
+
+static inline uint8_t duty_of(uint16_t high, uint16_t per) { //high*255/per without a divide, within 3 counts
+    uint8_t shift = 8; //duty_recip is 8.8 fixed point
+    while (per > 255) { //the period's top 8 bits pick the reciprocal, the extra shift comes off the product
+        per >>= 1;
+        shift++;
+    }
+    uint32_t duty = ((uint32_t)high*pgm_read_word(&duty_recip[per])) >> shift;
+    return clip_8(duty);
+}
+
+static inline uint8_t check_pulse(uint8_t ch, uint16_t high, uint16_t per, uint8_t was_stale) {
+    //the first pulse after a static stretch has no meaningful period
+    if (!was_stale) {
+        uint16_t min = (ch == RX_BRUSHLESS) ? TIMER1_COUNTS(RX_BRUSHLESS_PERIOD_MIN_US) : TIMER1_COUNTS(RX_BRUSHED_PERIOD_MIN_US);
+        if (per < min || per > FAILSAFE_MAX) return RX_FAULT_PERIOD;
+        if (high >= per) return RX_FAULT_WIDTH;
+    }
+    if (ch == RX_BRUSHLESS) {
+        uint16_t width = TIMER1_US(high);
+        if (width < rx_width_min || width > rx_width_max) return RX_FAULT_WIDTH;
+    }
+    return RX_OK;
+}
+
+void rx_update(void) {
+    for (uint8_t ch = 0; ch < RX_CHANNELS; ch++) {
+        uint8_t bit = 1 << ch;
+        rx_channel_t c;
+
+        SNAPSHOT_READ(rx_seq, c, channel[ch]);
+        uint16_t now = timer_now();
+
+        uint16_t high = c.high_time;
+        uint16_t per = c.period;
+        uint16_t age = now - c.edge_time;
+        uint8_t got_pulse = c.pulses != pulses_seen[ch];
+        pulses_seen[ch] = c.pulses;
+
+        if (got_pulse) {
+            uint8_t was_stale = stale & bit;
+            uint8_t fault = check_pulse(ch, high, per, was_stale);
+            stale &= ~bit;
+            if (fault) {
+                cut(ch, fault);
+            } else if (was_stale) {
+                //its period runs back to a rise before the static stretch: keep the output as it was, not counted
+                //toward recovery, until a pulse with a checked period arrives (timeout stays at FAILSAFE_MAX)
+                continue;
+            } else {
+                if (good[ch] < RX_RECOVER_PULSES && ++good[ch] == RX_RECOVER_PULSES) rx_faults &= ~bit;
+                //next frame due within this period plus 25 % (compared first, the sum can pass 16 bits above 8 MHz)
+                uint16_t t = (per < FAILSAFE_MAX - (per >> 2)) ? per + (per >> 2) : FAILSAFE_MAX;
+                if (t < FAILSAFE_MIN) t = FAILSAFE_MIN;
+                timeout[ch] = t;
+            }
+        } else if (!(stale & bit) && age > timeout[ch]) {
+            stale |= bit; //stays stale until the next pulse, so the 16-bit age can't wrap back to looking fresh
+            timeout[ch] = FAILSAFE_MAX;
+            //a brushed input sitting low is a valid 0 %, anything else static is a lost signal
+            if (ch == RX_BRUSHLESS || (level_of(ch) && !RX_BRUSHED_HOLD_HIGH)) {
+                cut(ch, RX_FAULT_LOST);
+                uint16_t loss = TIMER1_US(age);
+                if (loss > rx_worst_loss_us) rx_worst_loss_us = loss;
+            }
+        } else {
+            continue;
+        }
+
+        if (ch == RX_BRUSHLESS) {
+            if (rx_faults & bit) {
+                brushless_shutdown = 1;
+                brushless_power_in = 0;
+            } else {
+                brushless_shutdown = 0;
+                brushless_power_in = scale_reading(ch, TIMER1_US(high));
+            }
+        } else {
+            if (rx_faults & bit) {
+                pulse_duty_cycle_brushed[ch] = 0;
+            } else if (stale & bit) {
+                pulse_duty_cycle_brushed[ch] = scale_reading(ch, level_of(ch) ? 255 : 0);
+            } else {
+                pulse_duty_cycle_brushed[ch] = scale_reading(ch, duty_of(high, per));
+            }
+        }
+    }
+
+    cut_pairs();
+}
+
+#else
+//serial receiver: one frame carries every channel, so the link is watched as a whole. each drive stick
+//becomes the two duty readings of its pair (forward on A, back on B) and the weapon channel a pulse width,
+//the same readings the PWM inputs give, so calibration and everything downstream work unchanged
+static uint8_t link_stale = 1; //no frame within RX_FAILSAFE_MAX_US (none yet at power up)
+static uint16_t last_frame = 0;
+
+static inline uint8_t stick_duty(int16_t travel) { //us from center to duty 0-255, 500 us is full
+    if (travel <= 0) return 0;
+    if (travel > 500) travel = 500;
+    return ((uint16_t)travel*131) >> 8;
+}
+
+void rx_init(void) {
+    rx_serial_init();
+}
+
+void rx_update(void) {
+    uint16_t us[RX_SERIAL_CHANNELS];
+    uint8_t result = rx_serial_read(us);
+    uint16_t now = timer_now();
+
+    uint16_t age = now - last_frame;
+    if (result == RX_SERIAL_FRAME) {
+        last_frame = now;
+        link_stale = 0;
+
+        int16_t drive_1 = (int16_t)us[0] - RX_BRUSHLESS_CENTER_US;
+        int16_t drive_2 = (int16_t)us[1] - RX_BRUSHLESS_CENTER_US;
+        uint16_t reading[RX_CHANNELS] = {
+            stick_duty(drive_1), stick_duty(-drive_1), stick_duty(drive_2), stick_duty(-drive_2), us[2]
+        };
+
+        for (uint8_t ch = 0; ch < RX_CHANNELS; ch++) {
+            uint8_t bit = 1 << ch;
+            if (ch == RX_BRUSHLESS && (us[2] < rx_width_min || us[2] > rx_width_max)) {
+                cut(ch, RX_FAULT_WIDTH); //e.g. a failsafe position set on the transmitter
+            } else if (good[ch] < RX_RECOVER_PULSES && ++good[ch] == RX_RECOVER_PULSES) {
+                rx_faults &= ~bit;
+            }
+            uint8_t out = (rx_faults & bit) ? 0 : scale_reading(ch, reading[ch]);
+            if (ch == RX_BRUSHLESS) brushless_power_in = out;
+            else pulse_duty_cycle_brushed[ch] = out;
+        }
+        brushless_shutdown = (rx_faults >> RX_BRUSHLESS) & 1;
+    } else if (result == RX_SERIAL_FAILSAFE || (!link_stale && age > FAILSAFE_MAX)) {
+        uint16_t loss = TIMER1_US(age);
+        if (!link_stale && loss > rx_worst_loss_us) rx_worst_loss_us = loss;
+        link_stale = 1; //stays stale until the next frame, so the 16-bit age can't wrap back to looking fresh
+        for (uint8_t ch = 0; ch < RX_CHANNELS; ch++) cut(ch, RX_FAULT_LOST);
+        pulse_duty_cycle_brushed[0] = pulse_duty_cycle_brushed[1] = 0;
+        pulse_duty_cycle_brushed[2] = pulse_duty_cycle_brushed[3] = 0;
+        brushless_shutdown = 1;
+        brushless_power_in = 0;
+    }
+
+    cut_pairs();
+}
+#endif
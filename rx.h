@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdint.h>
+
+//receiver pulses are timestamped against TCNT1, which init_timer_1() runs free at F_CPU/8; the limits
+//below are in us and converted with TIMER1_COUNTS() (sched.h), brushless widths are reported in us
+#define RX_TIMER TCNT1
+
+//receiver front ends
+#define RX_PWM 0 //five PWM inputs, the CTRL_* pins
+#define RX_SBUS 1 //serial on USART0 (rx_serial.c), 100000 baud 8E2; the line is inverted, use an uninverted output or an inverter
+#define RX_IBUS 2 //FlySky serial, 115200 baud; needs F_CPU 16 MHz or more for the baud rate
+#define RX_CRSF 3 //Crossfire/ELRS serial, 420000 baud; needs F_CPU 20 MHz
+
+#define RX_PROTOCOL RX_PWM //the serial protocols take their input on PD0 (CTRL_1_A), the other CTRL_* pins are unused
+
+#define RX_CHANNELS 5
+#define RX_BRUSHLESS 4 //channel index of CTRL_3
+
+//default brushless range until a calibration is stored (see calib.h)
+#define RX_BRUSHLESS_MIN_US 1000 //shortest pulse the transmitter sends
+#define RX_BRUSHLESS_CENTER_US 1500 //pulse width for 0 brushless power
+#define RX_BRUSHLESS_MAX_US 2000 //pulse width for full brushless power
+#define RX_BRUSHLESS_MARGIN_US 200 //pulses further than this outside min..max are invalid and shut the motor down (receiver failsafe)
+#define RX_BRUSHLESS_VALID_US 800 //narrower brushless pulses are always invalid, whatever the calibration
+#define RX_BRUSHLESS_PULSE_MAX_US 2200 //so are wider ones
+
+//signal watchdog: each channel expects its next edge within one frame (its last valid period plus 25 %,
+//kept between the two limits below). rx_update() runs every scheduler tick, so an output is cut at most
+//about 1 ms after that
+#define RX_FAILSAFE_MIN_US 2000
+#define RX_FAILSAFE_MAX_US 25000 //also the timeout until a channel has shown a valid period
+#define RX_BRUSHED_PERIOD_MIN_US 500 //brushed inputs are duty cycle PWM, up to 2 kHz; also sets the pin change rate isrcheck budgets (Makefile)
+#define RX_BRUSHLESS_PERIOD_MIN_US 2500 //servo frames, up to 400 Hz
+#define RX_RECOVER_PULSES 3 //valid pulses in a row before a cut channel drives again
+#define RX_BRUSHED_HOLD_HIGH 0 //0: a brushed input held high is a lost signal (shorted to the supply, receiver latched), 1: 100 % duty,
+                                //only for receivers known to hold high on purpose; held low is always 0 %
+
+//fault codes in rx_fault[]
+#define RX_OK 0
+#define RX_FAULT_LOST 1 //no edges within a frame
+#define RX_FAULT_PERIOD 2 //frame period out of range
+#define RX_FAULT_WIDTH 3 //pulse width out of range
+
+//per-channel input range, set by calib_load(). a reading (brushed: duty 0-255, brushless: pulse width in us)
+//becomes clip((reading - zero), 0, span)*scale >> 8, one 16x16 multiply in rx_update()
+typedef struct {
+    uint16_t zero; //reading for 0 power
+    uint16_t span; //reading above zero for full power, at least 1
+    uint16_t scale; //RX_SCALE(span)
+} rx_range_t;
+
+#define RX_SCALE(span) ((uint16_t)((255UL*256)/(span))) //8.8 fixed point, span*scale stays within 16 bits
+
+extern rx_range_t rx_range[RX_CHANNELS];
+extern uint16_t rx_width_min; //valid brushless pulse widths, us
+extern uint16_t rx_width_max;
+extern uint16_t rx_raw[RX_CHANNELS]; //last reading before scaling, for calibration; only updated while the channel is healthy
+
+extern volatile uint8_t pulse_duty_cycle_brushed[4]; //0 (0%) to 255 (100%) duty cycle
+extern volatile uint8_t brushless_power_in; //0 (0%) to 255 (100%) power, directionless
+extern volatile uint8_t brushless_shutdown;
+
+extern volatile uint8_t rx_faults; //bit per channel, set while the channel is cut; a fault on either input of a brushed pair cuts the pair
+extern volatile uint8_t rx_fault[RX_CHANNELS]; //last fault code per channel, stays set after recovery
+extern volatile uint16_t rx_fault_count; //channel cuts since boot
+extern volatile uint16_t rx_worst_loss_us; //longest time from a channel's last edge to its cut
+
+void rx_init(void);
+void rx_update(void); //call every scheduler tick, turns the latest pulse measurements into the values above
@@ -0,0 +1,212 @@
+#include "rx_serial.h"
+#include "rx.h"
+#include "pins.h"
+#include "shared.h"
+#include "perf.h"
+#include "sched.h"
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <stdint.h>
+
+#if RX_PROTOCOL != RX_PWM
+
+#if BRUSHED_HW_PWM
+#error "RXD0 (PD0) is the OC3A bridge output in the BRUSHED_HW_PWM pin map"
+#endif
+
+#if RX_PROTOCOL == RX_SBUS
+#define BAUD 100000
+#define UCSRC_VAL ((1 << UPM01) | (1 << USBS0) | (1 << UCSZ01) | (1 << UCSZ00)) //8E2
+#define HEADER 0x0F
+#define FRAME_LEN 25 //header, 16 x 11-bit channels, flags, end byte
+#define SBUS_FLAG_LOST (1 << 2) //this frame repeats old data
+#define SBUS_FLAG_FAILSAFE (1 << 3) //receiver is in failsafe
+#elif RX_PROTOCOL == RX_IBUS
+#define BAUD 115200
+#define UCSRC_VAL ((1 << UCSZ01) | (1 << UCSZ00)) //8N1
+#define HEADER 0x20 //frame length, followed by the 0x40 command
+#define IBUS_COMMAND 0x40
+#define FRAME_LEN 32 //length, command, 14 x 16-bit channels, checksum
+#elif RX_PROTOCOL == RX_CRSF
+#define BAUD 420000
+#define UCSRC_VAL ((1 << UCSZ01) | (1 << UCSZ00)) //8N1
+#define HEADER 0xC8 //addressed to the flight controller
+#define CRSF_RC_CHANNELS 0x16 //frame type
+#define FRAME_LEN 26 //address, length, type, 16 x 11-bit channels, CRC; other frame types are skipped
+#else
+#error "unknown RX_PROTOCOL"
+#endif
+
+//U2X halves the divider's rounding step
+#define UBRR_VAL ((F_CPU + 4UL*BAUD)/(8UL*BAUD) - 1)
+#define BAUD_ACTUAL (F_CPU/(8UL*(UBRR_VAL + 1)))
+
+#if BAUD_ACTUAL*1000 > BAUD*(1000UL + RX_SERIAL_BAUD_TOLERANCE) || BAUD_ACTUAL*1000 < BAUD*(1000UL - RX_SERIAL_BAUD_TOLERANCE)
+#error "RX_PROTOCOL's baud rate can't be made accurately enough from this F_CPU"
+#endif
+
+#define POS_DROP 0xFF //skipping to the next idle gap
+
+typedef struct {
+    uint8_t b[FRAME_LEN];
+} frame_t;
+
+static frame_t frame[2]; //the interrupt fills one while main may copy the other
+static uint8_t fill = 0;
+static volatile uint8_t ready = 1; //last complete frame
+static volatile uint8_t frame_seq = 0; //bumped for every complete frame
+static uint8_t seen_seq = 0; //main's copy
+
+static uint8_t pos = POS_DROP; //next byte of the frame, the first frame starts after a gap
+static uint16_t last_byte = 0;
+#if RX_PROTOCOL == RX_CRSF
+static uint8_t expect = 0; //bytes in the current frame, from its length byte
+static uint8_t keep = 0; //current frame is RC channels and goes into the buffer
+#endif
+
+volatile uint16_t rx_serial_line_errors = 0;
+uint16_t rx_serial_check_errors = 0;
+
+static inline void drop(void) { //skip the rest of the frame
+    rx_serial_line_errors++;
+    pos = POS_DROP;
+}
+
+static inline void receive(void) {
+    uint8_t status = UCSR0A; //error flags belong to the byte in UDR0, read them first
+    uint8_t byte = UDR0;
+    uint16_t now = RX_TIMER;
+    if ((uint16_t)(now - last_byte) > TIMER1_COUNTS(RX_SERIAL_GAP_US)) pos = 0;
+    last_byte = now;
+
+    uint8_t p = pos;
+    if (p == POS_DROP) return;
+    if ((status & ((1 << FE0) | (1 << DOR0) | (1 << UPE0))) || (p == 0 && byte != HEADER)) {
+        drop();
+        return;
+    }
+#if RX_PROTOCOL == RX_IBUS
+    if (p == 1 && byte != IBUS_COMMAND) {
+        drop();
+        return;
+    }
+#endif
+
+#if RX_PROTOCOL == RX_CRSF
+    //only RC channel frames are kept, the rest (link statistics and so on) are counted past
+    if (p == 1) {
+        if (byte < 2 || byte > 62) {
+            drop();
+            return;
+        }
+        expect = byte + 2; //the length counts type, payload and CRC
+    } else if (p == 2) {
+        keep = byte == CRSF_RC_CHANNELS && expect == FRAME_LEN;
+    }
+    if (p < 2 || (keep && p < FRAME_LEN)) frame[fill].b[p] = byte;
+    if (++p < expect) {
+        pos = p;
+        return;
+    }
+    pos = 0; //frames may follow each other without a gap
+    if (!keep) return;
+#else
+    frame[fill].b[p] = byte;
+    if (++p < FRAME_LEN) {
+        pos = p;
+        return;
+    }
+    pos = POS_DROP; //the next frame starts after a gap
+#endif
+
+    ready = fill;
+    fill ^= 1;
+    frame_seq++;
+}
+
+ISR(USART0_RX_vect) {
+    PERF_ISR_BEGIN();
+    receive();
+    PERF_ISR_END(PERF_ISR_RX);
+}
+
+void rx_serial_init(void) {
+    WRITE_PIN(CTRL_1_A_PORT, CTRL_1_A_PIN, 1); //pullup, an unplugged receiver reads as an idle line
+
+    UBRR0 = UBRR_VAL;
+    UCSR0A = (1 << U2X0);
+    UCSR0C = UCSRC_VAL;
+    UCSR0B = (1 << RXEN0) | (1 << RXCIE0); //receive only, RXD0 overrides the pin
+}
+
+static inline uint16_t packed_11(const uint8_t* p, uint8_t n) { //channel n of 16 packed 11-bit values, LSB first
+    uint16_t bit = n*11;
+    const uint8_t* q = p + (bit >> 3);
+    uint32_t v = q[0] | ((uint16_t)q[1] << 8) | ((uint32_t)q[2] << 16);
+    return (v >> (bit & 7)) & 0x7FF;
+}
+
+static inline uint16_t packed_us(uint16_t v) { //SBUS/CRSF value to pulse width: 172 -> 988 us, 992 -> 1500, 1811 -> 2012
+    return ((v*5) >> 3) + 880;
+}
+
+#if RX_PROTOCOL == RX_CRSF
+static uint8_t crc8_dvb_s2(const uint8_t* p, uint8_t len) {
+    uint8_t crc = 0;
+    while (len--) {
+        crc ^= *p++;
+        for (uint8_t i = 0; i < 8; i++) crc = (crc & 0x80) ? (crc << 1) ^ 0xD5 : crc << 1;
+    }
+    return crc;
+}
+#endif
+
+static const uint8_t channel_map[RX_SERIAL_CHANNELS] = {
+    RX_SERIAL_CH_BRUSHED_1, RX_SERIAL_CH_BRUSHED_2, RX_SERIAL_CH_BRUSHLESS
+};
+
+uint8_t rx_serial_read(uint16_t us[RX_SERIAL_CHANNELS]) {
+    frame_t f;
+    uint8_t seq;
+
+    if (frame_seq == seen_seq) return RX_SERIAL_NONE;
+    do { //SNAPSHOT_READ, keeping the sequence number that was copied
+        seq = frame_seq;
+        barrier();
+        f = frame[ready];
+        barrier();
+    } while (seq != frame_seq);
+    seen_seq = seq;
+
+#if RX_PROTOCOL == RX_SBUS
+    uint8_t end = f.b[24];
+    if (end != 0x00 && (end & 0x0F) != 0x04) { //0x04, 0x14, 0x24, 0x34 on SBUS2 receivers
+        rx_serial_check_errors++;
+        return RX_SERIAL_NONE;
+    }
+    uint8_t flags = f.b[23];
+    if (flags & SBUS_FLAG_FAILSAFE) return RX_SERIAL_FAILSAFE;
+    if (flags & SBUS_FLAG_LOST) return RX_SERIAL_NONE;
+    for (uint8_t i = 0; i < RX_SERIAL_CHANNELS; i++) us[i] = packed_us(packed_11(&f.b[1], channel_map[i]));
+#elif RX_PROTOCOL == RX_IBUS
+    uint16_t sum = 0xFFFF;
+    for (uint8_t i = 0; i < FRAME_LEN - 2; i++) sum -= f.b[i];
+    if (sum != (f.b[30] | ((uint16_t)f.b[31] << 8))) {
+        rx_serial_check_errors++;
+        return RX_SERIAL_NONE;
+    }
+    for (uint8_t i = 0; i < RX_SERIAL_CHANNELS; i++) {
+        uint8_t c = 2 + 2*channel_map[i];
+        us[i] = (f.b[c] | ((uint16_t)f.b[c + 1] << 8)) & 0x0FFF; //top nibble carries channels 15-18
+    }
+#elif RX_PROTOCOL == RX_CRSF
+    if (crc8_dvb_s2(&f.b[2], FRAME_LEN - 3) != f.b[FRAME_LEN - 1]) { //type and payload
+        rx_serial_check_errors++;
+        return RX_SERIAL_NONE;
+    }
+    for (uint8_t i = 0; i < RX_SERIAL_CHANNELS; i++) us[i] = packed_us(packed_11(&f.b[3], channel_map[i]));
+#endif
+    return RX_SERIAL_FRAME;
+}
+
+#endif
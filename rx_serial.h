@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+#include "rx.h"
+
+//serial receiver on USART0. the interrupt assembles frames from the line (resyncing on the idle gap
+//between them) and publishes each complete one; rx_serial_read() checks it and decodes the mapped channels.
+//every output then comes from one link, so a lost link cuts them all at once
+
+//transmitter channels (0 based) for each output. AETR order puts the drive on aileron/elevator and
+//the weapon on throttle; any mixing is done in the transmitter
+#define RX_SERIAL_CH_BRUSHED_1 0 //centered stick, forward drives pair CTRL_1_A, back CTRL_1_B
+#define RX_SERIAL_CH_BRUSHED_2 1
+#define RX_SERIAL_CH_BRUSHLESS 2
+#define RX_SERIAL_CHANNELS 3 //outputs decoded per frame, in the order above
+
+#define RX_SERIAL_GAP_US 500 //line idle this long ends a frame; longer than a byte, shorter than any gap between frames
+#define RX_SERIAL_BAUD_TOLERANCE 25 //max baud rate error in per mille (UART sampling plus the clock)
+
+//rx_serial_read() results
+#define RX_SERIAL_NONE 0 //nothing new
+#define RX_SERIAL_FRAME 1 //us[] holds new pulse widths, 1000-2000 us at full stick
+#define RX_SERIAL_FAILSAFE 2 //the receiver reports its own link as lost
+
+extern volatile uint16_t rx_serial_line_errors; //frames dropped in the interrupt: framing, parity, overrun or a bad header
+extern uint16_t rx_serial_check_errors; //frames dropped for a bad checksum, CRC or end byte
+
+void rx_serial_init(void);
+uint8_t rx_serial_read(uint16_t us[RX_SERIAL_CHANNELS]); //latest frame, if there is a new one since the last call
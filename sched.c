@@ -0,0 +1,69 @@
+#include "sched.h"
+#include "shared.h"
+#include "perf.h"
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <stdint.h>
+
+volatile uint16_t sched_ticks = 0;
+
+static inline uint16_t timer_now(void) {
+    uint8_t sreg = SREG;
+    cli(); //16-bit timer registers share one TEMP byte with the interrupts
+    uint16_t t = SCHED_TIMER;
+    SREG = sreg;
+    return t;
+}
+
+static inline void run_task(task_t* t) {
+    uint16_t start = timer_now();
+    t->run();
+    uint16_t elapsed = timer_now() - start;
+    if (elapsed > t->wcet) t->wcet = elapsed;
+    t->runs++;
+
+    //finished after the next release was due: count it and skip ahead so the rate stays fixed instead of catching up in a burst
+    uint16_t done = read_counter16(&sched_ticks);
+    t->release += t->period;
+    while ((int16_t)(done - t->release) >= 0) {
+        t->release += t->period;
+        t->misses++;
+    }
+}
+
+void sched_run(task_t* tasks, uint8_t count) {
+    uint16_t tick = read_counter16(&sched_ticks);
+    for (uint8_t i = 0; i < count; i++) {
+        tasks[i].release += tick; //phases count from now, not from reset
+    }
+
+    set_sleep_mode(SLEEP_MODE_IDLE); //timers, TWI, ADC and pin change interrupts all keep running and wake the CPU
+
+    while (1) {
+        tick = read_counter16(&sched_ticks);
+        perf_loop(tick);
+        for (uint8_t i = 0; i < count; i++) {
+            if ((int16_t)(tick - tasks[i].release) >= 0) run_task(&tasks[i]);
+        }
+
+        //sleep until the next interrupt unless a tick arrived while the tasks ran. sei() only takes effect
+        //after the following instruction, so a tick can't slip in between the check and the sleep
+        cli();
+        if (sched_ticks == tick) {
+            uint16_t start = SCHED_TIMER; //interrupts are off already
+            uint16_t isr_start = perf_isr_counts;
+            sleep_enable();
+            sei();
+            sleep_cpu();
+            sleep_disable();
+            //the waking interrupt (and any queued behind it) is load, not idle: read both ends together
+            cli();
+            uint16_t slept = (SCHED_TIMER - start) - (perf_isr_counts - isr_start);
+            sei();
+            perf_idle(slept);
+        } else {
+            sei();
+        }
+    }
+}
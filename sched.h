@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+
+//timer 1 runs free at F_CPU/8 (init_timer_1()) as the time base for the tick, receiver pulses and execution
+//times: 1 count per us at 8 MHz, 2 at 16 MHz, 2.5 at 20 MHz. times are configured in us and converted here
+#define TIMER1_PRESCALER 8
+#define TIMER1_PER_MS (F_CPU/TIMER1_PRESCALER/1000) //counts per ms
+#define TIMER1_COUNTS(us) ((uint16_t)((us)*(uint32_t)TIMER1_PER_MS/1000)) //a constant time to counts, rounded down
+#define TIMER1_FITS(us) ((uint32_t)(us)*TIMER1_PER_MS/1000 <= 65535) //for _Static_assert: counts for us don't wrap
+
+#if F_CPU % (TIMER1_PRESCALER*1000UL) || TIMER1_PER_MS < 1000
+#error "timer 1 needs F_CPU to be a multiple of 8 kHz, and at least 8 MHz for 1 us resolution"
+#endif
+
+#if TIMER1_PER_MS == 1000
+#define TIMER1_US(counts) (counts)
+#else
+#define TIMER1_US_SCALE ((uint16_t)(65536000UL/TIMER1_PER_MS)) //us per count, 0.16 fixed point
+#define TIMER1_US(counts) ((uint16_t)(((uint32_t)(counts)*TIMER1_US_SCALE + 0x8000) >> 16)) //a measured count to us, rounded
+#endif
+
+#define SCHED_TICK_US 1032 //system tick period, 969 Hz; also the display refresh rate
+#define SCHED_TICK_COUNTS TIMER1_COUNTS(SCHED_TICK_US)
+#define SCHED_MS(ms) ((uint16_t)((ms)*1000UL/SCHED_TICK_US)) //period in ticks, rounded down
+#define SCHED_TIMER TCNT1 //timer 1, used for execution times
+
+typedef struct {
+    void (*run)(void);
+    uint16_t period; //ticks between releases
+    uint16_t release; //tick of the next release (the phase offset until sched_run() starts)
+    uint16_t runs;
+    uint16_t misses; //runs that finished after their next release was already due, each skipped release counts
+    uint16_t wcet; //longest run so far, timer 1 counts (TIMER1_US())
+} task_t;
+
+#define TASK(fn, period, phase) {fn, period, phase, 0, 0, 0}
+
+extern volatile uint16_t sched_ticks; //free running tick count
+
+static inline void sched_tick(void) { //call from the tick interrupt
+    sched_ticks++;
+}
+
+void sched_run(task_t* tasks, uint8_t count); //never returns; tasks due on the same tick run in table order, the CPU idles in between
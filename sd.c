@@ -1,15 +1,376 @@
-#include <avr/io.h>
+#include "sd.h"
 #include "pins.h"
+#include <avr/io.h>
 #include <stdint.h>
-#include <avr/pgmspace.h>
+#include <string.h>
+
+//the SD pins are the SPI1 peripheral: MISO1 PC0, SCK1 PC1, SS1 PE2 (driven as chip select), MOSI1 PE3
+#define SPI_SLOW ((1 << SPE1) | (1 << MSTR1) | (1 << SPR11)) //F_CPU/64 (125 kHz at 8 MHz), cards need <= 400 kHz until initialized
+#define SPI_FAST ((1 << SPE1) | (1 << MSTR1)) //F_CPU/2 (4 MHz at 8 MHz) with SPI2X1
+
+#if F_CPU/64 > 400000
+#error "SPI_SLOW is too fast for card initialization at this F_CPU"
+#endif
+
+#define CMD0 0 //go idle
+#define CMD8 8 //send interface condition
+#define CMD16 16 //set block length (byte addressed cards)
+#define CMD25 25 //write multiple blocks
+#define CMD55 55 //next command is an application command
+#define CMD58 58 //read OCR
+#define ACMD41 41 //send operating condition
+
+#define R1_IDLE 0x01
+#define R1_ILLEGAL 0x04
+
+#define TOKEN_MULTI 0xFC //start of a block in a CMD25 stream
+#define TOKEN_STOP 0xFD //end of a CMD25 stream
+#define DATA_ACCEPTED 0x05 //data response, low 5 bits
+
+//until the card is initialized each sd_poll() call clocks at most INIT_CHUNK bytes at SPI_SLOW, 64 us a byte at
+//8 MHz, so a command frame, its R1 wait and any trailing response bytes are spread over several calls
+#define INIT_CHUNK 4 //256 us at 8 MHz, 320 us with the byte after a deselect
+#define POWER_UP_BYTES 10 //80 clocks with CS high
+#define NCR_MAX 8 //bytes the card may take before R1
+#define RESET_TRIES 10 //CMD0 attempts
+#define OP_COND_TRIES 200 //CMD55 + ACMD41 attempts, about 6 sd_poll() calls each; the spec allows the card 1 s
+#define BUSY_TRIES 60000 //sd_poll() calls the card may stay busy after a block before it is given up on
+
+enum {
+    P_NONE,
+    P_POWER_UP, //74+ clocks with CS high
+    P_RESET, //CMD0
+    P_IF_COND, //CMD8
+    P_APP_CMD, //CMD55 ahead of each ACMD41
+    P_OP_COND, //ACMD41 until the card leaves idle
+    P_OCR, //CMD58, block or byte addressing
+    P_BLOCK_LEN, //CMD16, byte addressed cards only
+    P_READY,
+    P_WAIT, //stream open, waiting for a full sector
+    P_DATA, //clocking out a sector SD_CHUNK bytes at a time
+    P_RESPONSE, //CRC and data response
+    P_BUSY, //card programming the block
+    P_STOP_BUSY, //card programming after the stop token
+};
+
+//one ring for the stream: sd_poll() starts a block once a sector's worth is queued and frees it SD_CHUNK bytes
+//at a time as they go out, so sd_log() only needs the slack beyond one sector to ride out the card's busy time
+//(RING_SLACK at the 3.2 kB/s log rate is 40 ms, longer stalls drop records). sd_log() and sd_poll() both run
+//in main, the indices need no locking
+#define RING_SLACK 128
+#define RING_SIZE (SD_BLOCK_SIZE + RING_SLACK)
+
+static uint8_t ring[RING_SIZE];
+static uint16_t ring_head = 0; //next byte sd_log() writes
+static uint16_t ring_tail = 0; //next byte sd_poll() sends
+static uint16_t ring_used = 0;
+static uint16_t send_pos = 0; //bytes of the current block sent
+static uint16_t blocks_written = 0; //in the current stream
+
+static uint8_t phase = P_NONE;
+static uint8_t stop_requested = 0;
+static uint8_t version_2 = 0; //card answered CMD8
+static uint8_t block_addressed = 0; //SDHC/SDXC, addresses are in blocks instead of bytes
+static uint16_t tries = 0;
+
+//init command in flight: frame to send, then R1, then resp_len more bytes
+static uint8_t cmd_frame[7];
+static uint8_t cmd_pos; //frame bytes sent
+static uint8_t cmd_wait; //bytes waited for R1
+static uint8_t cmd_r1;
+static uint8_t cmd_resp[4];
+static uint8_t cmd_resp_len;
+static uint8_t cmd_resp_pos;
+static uint8_t cmd_active = 0;
+
+volatile uint16_t sd_dropped = 0;
+
+static uint8_t spi_xfer(uint8_t data) {
+    SPDR1 = data;
+    while (!(SPSR1 & (1 << SPIF1))); //16 cycles at full speed, not worth an interrupt per byte
+    return SPDR1;
+}
+
+static inline void select(void) {
+    WRITE_PIN(SD_SS_PORT, SD_SS_PIN, 0);
+}
+
+static inline void deselect(void) {
+    WRITE_PIN(SD_SS_PORT, SD_SS_PIN, 1);
+    spi_xfer(0xFF); //the card only releases MISO on the next clock
+}
+
+static uint8_t command(uint8_t cmd, uint32_t arg, uint8_t crc) { //returns R1, 0xFF on timeout; at SPI_FAST only
+    spi_xfer(0xFF);
+    spi_xfer(0x40 | cmd);
+    spi_xfer(arg >> 24);
+    spi_xfer(arg >> 16);
+    spi_xfer(arg >> 8);
+    spi_xfer(arg);
+    spi_xfer(crc); //only checked for CMD0 and CMD8
+    for (uint8_t i = 0; i < NCR_MAX; i++) {
+        uint8_t r1 = spi_xfer(0xFF);
+        if (!(r1 & 0x80)) return r1;
+    }
+    return 0xFF;
+}
+
+static void fail(void) {
+    deselect();
+    cmd_active = 0;
+    phase = P_NONE;
+}
 
-static inline void init_sd(void) {
-    //set MOSI and SCK output, all others input
+static void start_command(uint8_t cmd, uint32_t arg, uint8_t crc, uint8_t resp_len) { //clocks nothing yet
+    cmd_frame[0] = 0xFF;
+    cmd_frame[1] = 0x40 | cmd;
+    cmd_frame[2] = arg >> 24;
+    cmd_frame[3] = arg >> 16;
+    cmd_frame[4] = arg >> 8;
+    cmd_frame[5] = arg;
+    cmd_frame[6] = crc; //only checked for CMD0 and CMD8
+    cmd_pos = 0;
+    cmd_wait = 0;
+    cmd_r1 = 0xFF;
+    cmd_resp_len = resp_len;
+    cmd_resp_pos = 0;
+    cmd_active = 1;
+    select();
+}
+
+static uint8_t step_command(void) { //clocks up to INIT_CHUNK bytes, returns 1 once cmd_r1 (0xFF on timeout) and cmd_resp are in
+    for (uint8_t n = 0; n < INIT_CHUNK; n++) {
+        if (cmd_pos < sizeof(cmd_frame)) {
+            spi_xfer(cmd_frame[cmd_pos++]);
+        } else if (cmd_r1 & 0x80) {
+            cmd_r1 = spi_xfer(0xFF);
+            if ((cmd_r1 & 0x80) && ++cmd_wait >= NCR_MAX) break;
+        } else if (cmd_resp_pos < cmd_resp_len) {
+            cmd_resp[cmd_resp_pos++] = spi_xfer(0xFF);
+        } else {
+            break;
+        }
+    }
+    if (cmd_pos < sizeof(cmd_frame)) return 0;
+    if (cmd_r1 & 0x80) {
+        if (cmd_wait < NCR_MAX) return 0;
+        cmd_r1 = 0xFF;
+    } else if (cmd_resp_pos < cmd_resp_len) {
+        return 0;
+    }
+    cmd_active = 0;
+    return 1;
+}
+
+void sd_init(void) {
     DDRx(SD_SCK_PORT) |= SD_SCK_PIN;
     DDRx(SD_MOSI_PORT) |= SD_MOSI_PIN;
-    DDRx(SD_MISO_PORT) |= !SD_MISO_PIN;
-    DDRx(SD_SS_PORT) |= !SD_SS_PIN;
+    DDRx(SD_SS_PORT) |= SD_SS_PIN; //SS1 as an output also keeps SPI1 in master mode
+    DDRx(SD_MISO_PORT) &= ~SD_MISO_PIN;
+    WRITE_PIN(SD_SS_PORT, SD_SS_PIN, 1);
+    WRITE_PIN(SD_MISO_PORT, SD_MISO_PIN, 1); //pullup, reads 0xFF with no card
+
+    SPCR1 = SPI_SLOW;
+    SPSR1 = 0;
+    cmd_active = 0;
+    tries = 0;
+    phase = P_POWER_UP;
+}
+
+static void step_init(void) {
+    if (phase == P_POWER_UP) {
+        for (uint8_t i = 0; i < INIT_CHUNK; i++) spi_xfer(0xFF);
+        tries += INIT_CHUNK;
+        if (tries >= POWER_UP_BYTES) {
+            tries = 0;
+            phase = P_RESET;
+        }
+        return;
+    }
+
+    if (!cmd_active) {
+        switch (phase) {
+            case P_RESET: start_command(CMD0, 0, 0x95, 0); break;
+            case P_IF_COND: start_command(CMD8, 0x1AA, 0x87, 4); break; //2.7-3.6 V, check pattern 0xAA
+            case P_APP_CMD: start_command(CMD55, 0, 0x01, 0); break;
+            case P_OP_COND: start_command(ACMD41, version_2 ? (1UL << 30) : 0, 0x01, 0); break; //HCS: host supports block addressing
+            case P_OCR: start_command(CMD58, 0, 0x01, 4); break;
+            case P_BLOCK_LEN: start_command(CMD16, SD_BLOCK_SIZE, 0x01, 0); break;
+        }
+    }
+    if (!step_command()) return;
+
+    uint8_t r1 = cmd_r1;
+    if (phase != P_APP_CMD) deselect(); //CMD55 and its ACMD41 go out under one select
+    switch (phase) {
+        case P_RESET:
+            if (r1 == R1_IDLE) phase = P_IF_COND;
+            else if (++tries >= RESET_TRIES) fail();
+            break;
+        case P_IF_COND:
+            if (r1 & R1_ILLEGAL) {
+                version_2 = 0; //v1 card
+            } else if (r1 == R1_IDLE && cmd_resp[3] == 0xAA) {
+                version_2 = 1;
+            } else {
+                fail();
+                break;
+            }
+            tries = 0;
+            phase = P_APP_CMD;
+            break;
+        case P_APP_CMD:
+            phase = P_OP_COND;
+            break;
+        case P_OP_COND:
+            if (r1 == 0) phase = version_2 ? P_OCR : P_BLOCK_LEN; //v1 cards are byte addressed
+            else if (r1 != R1_IDLE || ++tries >= OP_COND_TRIES) fail();
+            else phase = P_APP_CMD;
+            break;
+        case P_OCR:
+            if (r1 != 0) {
+                fail();
+                break;
+            }
+            block_addressed = (cmd_resp[0] & 0x40) != 0; //CCS
+            phase = block_addressed ? P_READY : P_BLOCK_LEN;
+            break;
+        case P_BLOCK_LEN:
+            if (r1 == 0) phase = P_READY;
+            else fail();
+            break;
+    }
+
+    if (phase == P_READY) {
+        SPCR1 = SPI_FAST;
+        SPSR1 = (1 << SPI2X1);
+    }
+}
+
+static void step_stream(void) {
+    uint8_t n;
+
+    switch (phase) {
+        case P_WAIT:
+            if (stop_requested && ring_used && ring_used < SD_BLOCK_SIZE) { //pad the last sector, there is room
+                for (uint16_t pad = SD_BLOCK_SIZE - ring_used; pad; pad--) {
+                    ring[ring_head] = 0;
+                    if (++ring_head == RING_SIZE) ring_head = 0;
+                }
+                ring_used = SD_BLOCK_SIZE;
+            }
+            if (ring_used >= SD_BLOCK_SIZE) {
+                spi_xfer(TOKEN_MULTI);
+                send_pos = 0;
+                phase = P_DATA;
+            } else if (stop_requested) {
+                spi_xfer(TOKEN_STOP);
+                spi_xfer(0xFF); //busy starts one byte after the stop token
+                tries = 0;
+                phase = P_STOP_BUSY;
+            }
+            break;
+        case P_DATA: {
+            n = SD_CHUNK;
+            if (SD_BLOCK_SIZE - send_pos < SD_CHUNK) n = SD_BLOCK_SIZE - send_pos;
+            send_pos += n;
+            ring_used -= n; //sd_log() may refill these bytes once this call returns
+            uint16_t tail = ring_tail;
+            while (n--) {
+                spi_xfer(ring[tail]);
+                if (++tail == RING_SIZE) tail = 0;
+            }
+            ring_tail = tail;
+            if (send_pos == SD_BLOCK_SIZE) phase = P_RESPONSE;
+            break;
+        }
+        case P_RESPONSE:
+            spi_xfer(0xFF); //CRC, ignored in SPI mode
+            spi_xfer(0xFF);
+            if ((spi_xfer(0xFF) & 0x1F) != DATA_ACCEPTED) {
+                fail();
+                break;
+            }
+            blocks_written++;
+            tries = 0;
+            phase = P_BUSY;
+            break;
+        case P_BUSY:
+        case P_STOP_BUSY:
+            //MISO is held low while the card programs, check a few bytes per call
+            for (n = 0; n < SD_CHUNK; n++) {
+                if (spi_xfer(0xFF) == 0xFF) break;
+            }
+            if (n < SD_CHUNK) {
+                if (phase == P_BUSY) {
+                    phase = P_WAIT;
+                } else {
+                    deselect();
+                    stop_requested = 0;
+                    phase = P_READY;
+                }
+            } else if (++tries >= BUSY_TRIES) {
+                fail();
+            }
+            break;
+    }
+}
+
+void sd_poll(void) {
+    if (phase >= P_WAIT) step_stream();
+    else if (phase != P_NONE && phase != P_READY) step_init();
+}
+
+uint8_t sd_state(void) {
+    if (phase == P_NONE) return SD_NONE;
+    if (phase < P_READY) return SD_STARTING;
+    if (phase == P_READY) return SD_READY;
+    if (stop_requested) return SD_STOPPING;
+    return SD_STREAMING;
+}
+
+uint8_t sd_start(uint32_t block) {
+    if (phase != P_READY) return 0;
+
+    select();
+    if (command(CMD25, block_addressed ? block : block*SD_BLOCK_SIZE, 0x01) != 0) {
+        fail();
+        return 0;
+    }
+    spi_xfer(0xFF); //at least one byte between the response and the first data token
+
+    ring_head = ring_tail = ring_used = 0;
+    blocks_written = 0;
+    stop_requested = 0;
+    phase = P_WAIT;
+    return 1;
+}
+
+uint16_t sd_blocks(void) {
+    return blocks_written;
+}
+
+void sd_stop(void) {
+    if (phase < P_WAIT || stop_requested) return;
+    stop_requested = 1; //sd_poll() pads the partial sector once it is the last one queued
+}
+
+uint8_t sd_log(const void* data, uint8_t len) {
+    if (phase < P_WAIT || stop_requested) return 0;
+
+    if (len > RING_SIZE - ring_used) {
+        sd_dropped++;
+        return 0;
+    }
 
-    CMD0();
-    PORTB |= (1 << )
-}
\ No newline at end of file
+    //records may straddle sectors and the end of the ring
+    const uint8_t* src = data;
+    uint8_t n = len;
+    if (RING_SIZE - ring_head < n) n = RING_SIZE - ring_head;
+    memcpy(&ring[ring_head], src, n);
+    memcpy(ring, src + n, len - n);
+    ring_head += len;
+    if (ring_head >= RING_SIZE) ring_head -= RING_SIZE;
+    ring_used += len;
+    return 1;
+}
@@ -1,5 +1,25 @@
 #pragma once
 
-void sd_init(void);
-void sd_write(void);
-void sd_read(void);
\ No newline at end of file
+#include <stdint.h>
+
+#define SD_BLOCK_SIZE 512
+#define SD_CHUNK 32 //max data bytes clocked out per sd_poll() call, about 80 us at 4 MHz SPI
+#define SD_LOG_FIRST_BLOCK 2048 //raw log stream starts 1 MiB into the card (the card is dedicated to logging, no filesystem), later boots continue after it (calib_sd)
+#define SD_BLACKBOX_FIRST_BLOCK 1024 //black box dumps, one block each (see blackbox.h)
+
+//driver state, see sd_state()
+#define SD_NONE 0 //no card, init failed or a write was rejected
+#define SD_STARTING 1 //power-up sequence still running inside sd_poll()
+#define SD_READY 2 //initialized, no stream open
+#define SD_STREAMING 3 //CMD25 multi-block write open, sd_log() accepts data
+#define SD_STOPPING 4 //flushing the last sectors before the stop token
+
+extern volatile uint16_t sd_dropped; //records refused by sd_log() because the stream ring was full
+
+void sd_init(void); //set up SPI1, the card itself is initialized incrementally by sd_poll()
+void sd_poll(void); //advance the driver by one small step, never waits on the card; call every main loop iteration
+uint8_t sd_state(void);
+uint8_t sd_start(uint32_t block); //open a multi-block write at block, returns 0 unless the state was SD_READY
+uint16_t sd_blocks(void); //blocks the card has accepted since sd_start()
+void sd_stop(void); //pad and flush the partial sector, then close the stream
+uint8_t sd_log(const void* data, uint8_t len); //append to the stream (main context only), returns 0 and drops the whole record if it doesn't fit
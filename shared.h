@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdint.h>
+
+//lock-free exchange between the main loop and the interrupts, so neither side needs cli().
+//interrupts don't nest and main can't preempt an interrupt, so only the main side can ever
+//see a half-finished update; every pattern below relies on that, and on single byte accesses being atomic.
+
+#define barrier() __asm__ __volatile__("" ::: "memory") //keep the compiler from moving memory accesses across this point
+
+//interrupt -> main: sequence-counted snapshot. the interrupt increments seq (uint8_t) after every update,
+//main copies until seq is the same before and after the copy
+#define SNAPSHOT_READ(seq, dst, src) do { \
+    uint8_t seq_before_; \
+    do { \
+        seq_before_ = (seq); \
+        barrier(); \
+        (dst) = (src); \
+        barrier(); \
+    } while (seq_before_ != (seq)); \
+    } while (0)
+
+static inline uint16_t read_counter16(volatile uint16_t* counter) { //a counter an interrupt increments is its own sequence number
+    uint16_t value;
+    do {
+        value = *counter;
+    } while (value != *counter);
+    return value;
+}
+
+//main -> interrupt: double buffer. main fills the back copy and flips front with a single byte write,
+//so the interrupt always reads a complete copy (DOUBLE_BUFFER_FRONT) and never the one being written
+#define DOUBLE_BUFFER(type) struct { type copy[2]; volatile uint8_t front; }
+#define DOUBLE_BUFFER_FRONT(db) ((db).copy[(db).front])
+#define DOUBLE_BUFFER_PUBLISH(db, value) do { \
+    uint8_t back_ = (db).front ^ 1; \
+    (db).copy[back_] = (value); \
+    barrier(); \
+    (db).front = back_; \
+    } while (0)
+
+//single producer, single consumer byte queue. head is only written by the producer and tail only by
+//the consumer, so either side may be an interrupt (several interrupts can share the producer side since they don't nest)
+#define SPSC_SIZE 16 //must be a power of 2
+#define SPSC_MASK (SPSC_SIZE - 1)
+
+typedef struct {
+    uint8_t data[SPSC_SIZE];
+    volatile uint8_t head; //next slot to write
+    volatile uint8_t tail; //next slot to read
+} spsc_t;
+
+static inline uint8_t spsc_push(spsc_t* q, uint8_t value) { //returns 0 if the queue is full
+    uint8_t head = q->head;
+    if ((uint8_t)(head - q->tail) >= SPSC_SIZE) return 0;
+    q->data[head & SPSC_MASK] = value;
+    barrier();
+    q->head = head + 1;
+    return 1;
+}
+
+static inline uint8_t spsc_pop(spsc_t* q, uint8_t* value) { //returns 0 if the queue is empty
+    uint8_t tail = q->tail;
+    if (tail == q->head) return 0;
+    *value = q->data[tail & SPSC_MASK];
+    barrier();
+    q->tail = tail + 1;
+    return 1;
+}
+
+//events raised in interrupts and handled in the main loop
+#define EVENT_ACCEL_NACK 1 //accelerometer transfer was not acknowledged
+#define EVENT_ACCEL_OVERRUN 2 //sensor FIFO overflowed, samples were lost
+
+extern spsc_t events; //interrupts push, main pops (defined in main.c)
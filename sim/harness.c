@@ -0,0 +1,438 @@
+// simavr harness for test.elf: runs the firmware against a virtual LIS2HH12 on TWI0,
+// receiver pulse trains on the CTRL_* pins and a battery voltage on ADC3, and reports
+// per-vector interrupt cost, interrupt latency, main loop rate and stick-to-motor latency.
+//
+// usage: harness [options] test.elf
+//   --seconds S       simulated run time (default 3)
+//   --step S          time of the stick step (default 1)
+//   --vbat MV         battery voltage in mV (default 11100)
+//   --rx-hz HZ        brushed input PWM frequency (default 2000)
+//   --loop-pc ADDR    byte address of a function called once per main loop iteration (control task run)
+//   --armed-pc ADDR   byte address of the function main() enters once booted (sched_run), reports reset to armed time
+//   --brushed-mask M  PORTD bits that are bridge outputs (default 0xf0, 0x65 for BRUSHED_HW_PWM)
+//   --mcu NAME        simavr core (default atmega328pb)
+//   --f-cpu HZ        clock the firmware was built for (default 8000000)
+//   --brushless-pin P ESC output as port letter and bit (default B6, E1 for the crystal pin map, D2 for BRUSHLESS_HW_PULSE)
+//   --ctrl-pins LIST  receiver inputs CTRL_1_A,CTRL_1_B,CTRL_2_A,CTRL_2_B,CTRL_3 (default D0,D1,D2,D3,E0,
+//                     D4,D1,D7,D3,E0 for BRUSHED_HW_PWM, D0,D1,E1,D3,E0 for BRUSHLESS_HW_PULSE)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "sim_irq.h"
+#include "sim_time.h"
+#include "sim_cycle_timers.h"
+#include "avr_ioport.h"
+#include "avr_twi.h"
+#include "avr_adc.h"
+
+#define VECTORS 45
+
+static const char* vector_names[VECTORS] = {
+    "RESET", "INT0", "INT1", "PCINT0", "PCINT1", "PCINT2", "WDT", "TIMER2_COMPA", "TIMER2_COMPB",
+    "TIMER2_OVF", "TIMER1_CAPT", "TIMER1_COMPA", "TIMER1_COMPB", "TIMER1_OVF", "TIMER0_COMPA",
+    "TIMER0_COMPB", "TIMER0_OVF", "SPI0_STC", "USART0_RX", "USART0_UDRE", "USART0_TX", "ADC",
+    "EE_READY", "ANALOG_COMP", "TWI0", "SPM_READY", "USART0_START", "PCINT3", "USART1_RX",
+    "USART1_UDRE", "USART1_TX", "USART1_START", "TIMER3_CAPT", "TIMER3_COMPA", "TIMER3_COMPB",
+    "TIMER3_OVF", "CFD", "PTC_EOC", "PTC_WCOMP", "SPI1_STC", "TWI1", "TIMER4_CAPT",
+    "TIMER4_COMPA", "TIMER4_COMPB", "TIMER4_OVF",
+};
+
+static avr_t* avr;
+
+// ---------------------------------------------------------------------------
+// interrupt profiler
+
+typedef struct {
+    uint8_t vector;
+    uint64_t count;
+    uint64_t cycles;
+    uint64_t max_cycles;
+    uint64_t max_latency;
+    avr_cycle_count_t pending_at;
+    avr_cycle_count_t started_at;
+} vector_stats_t;
+
+static vector_stats_t stats[VECTORS];
+
+static void int_pending(struct avr_irq_t* irq, uint32_t value, void* param)
+{
+    (void)irq;
+    vector_stats_t* s = param;
+    if (value) s->pending_at = avr->cycle;
+}
+
+static void int_running(struct avr_irq_t* irq, uint32_t value, void* param)
+{
+    (void)irq;
+    vector_stats_t* s = param;
+    if (value) {
+        s->started_at = avr->cycle;
+        uint64_t latency = s->started_at - s->pending_at;
+        if (s->pending_at && latency > s->max_latency) s->max_latency = latency;
+    } else if (s->started_at) {
+        uint64_t c = avr->cycle - s->started_at;
+        s->count++;
+        s->cycles += c;
+        if (c > s->max_cycles) s->max_cycles = c;
+        s->started_at = 0;
+    }
+}
+
+static void profiler_attach(void)
+{
+    for (int v = 1; v < VECTORS; v++) {
+        stats[v].vector = v;
+        avr_irq_t* irq = avr_get_interrupt_irq(avr, v);
+        if (!irq) continue; // vector not modelled by this core
+        avr_irq_register_notify(irq + AVR_INT_IRQ_PENDING, int_pending, &stats[v]);
+        avr_irq_register_notify(irq + AVR_INT_IRQ_RUNNING, int_running, &stats[v]);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// virtual LIS2HH12 on TWI0, 1g = 16384 counts
+
+#define LIS_ADDR (0x1E << 1)
+#define LIS_ODR 200 // matches CTRL1 = 0x4F
+
+typedef struct {
+    avr_irq_t* irq;
+    uint8_t selected;
+    uint8_t have_reg;
+    uint8_t reg;
+    uint8_t regs[0x40];
+    uint64_t consumed; // samples read out of the fifo
+    uint64_t base; // samples produced before the fifo was enabled
+    int16_t xyz[3];
+} lis2hh12_t;
+
+static lis2hh12_t lis;
+
+static uint64_t lis_produced(void)
+{
+    return avr->cycle * LIS_ODR / avr->frequency;
+}
+
+static uint8_t lis_fifo_level(void)
+{
+    uint64_t level = lis_produced() - lis.consumed;
+    if (level > 32) {
+        lis.consumed = lis_produced() - 32; // stream mode drops the oldest
+        level = 32;
+    }
+    return level;
+}
+
+static uint8_t lis_read(void)
+{
+    uint8_t r = lis.reg;
+    uint8_t fifo = lis.regs[0x22] & 0x80;
+    uint8_t v;
+
+    if (r >= 0x28 && r <= 0x2D) {
+        const uint8_t* b = (const uint8_t*)lis.xyz;
+        v = b[r - 0x28];
+        if (r == 0x2D) {
+            if (fifo && lis_fifo_level()) lis.consumed++;
+            if (fifo) { lis.reg = 0x28; return v; } // pointer wraps in fifo mode
+        }
+    } else if (r == 0x2F) {
+        uint8_t level = lis_fifo_level();
+        v = (level >= (lis.regs[0x2E] & 0x1F) ? 0x80 : 0) | (level == 32 ? 0x40 : 0) |
+            (level == 0 ? 0x20 : 0) | (level & 0x1F);
+    } else {
+        v = lis.regs[r & 0x3F];
+    }
+    lis.reg++;
+    return v;
+}
+
+static void lis_twi_hook(struct avr_irq_t* irq, uint32_t value, void* param)
+{
+    (void)irq; (void)param;
+    avr_twi_msg_irq_t m;
+    m.u.v = value;
+
+    if (m.u.twi.msg & TWI_COND_STOP) lis.selected = 0;
+    if (m.u.twi.msg & TWI_COND_START) {
+        lis.selected = 0;
+        if ((m.u.twi.addr & 0xFE) == LIS_ADDR) {
+            lis.selected = m.u.twi.addr;
+            lis.have_reg = lis.have_reg && (m.u.twi.addr & 1); // a write restarts register addressing
+            avr_raise_irq(lis.irq + TWI_IRQ_INPUT, avr_twi_irq_msg(TWI_COND_ACK, lis.selected, 1));
+        }
+    }
+    if (!lis.selected) return;
+
+    if (m.u.twi.msg & TWI_COND_WRITE) {
+        avr_raise_irq(lis.irq + TWI_IRQ_INPUT, avr_twi_irq_msg(TWI_COND_ACK, lis.selected, 1));
+        if (!lis.have_reg) {
+            lis.reg = m.u.twi.data;
+            lis.have_reg = 1;
+        } else {
+            lis.regs[lis.reg & 0x3F] = m.u.twi.data;
+            lis.reg++;
+        }
+    }
+    if (m.u.twi.msg & TWI_COND_READ) {
+        avr_raise_irq(lis.irq + TWI_IRQ_INPUT, avr_twi_irq_msg(TWI_COND_READ, lis.selected, lis_read()));
+    }
+}
+
+static void lis_attach(void)
+{
+    static const char* names[2] = { "8>lis.out", "32<lis.in" };
+    lis.irq = avr_alloc_irq(&avr->irq_pool, 0, 2, names);
+    avr_irq_register_notify(lis.irq + TWI_IRQ_OUTPUT, lis_twi_hook, NULL);
+    avr_connect_irq(lis.irq + TWI_IRQ_INPUT, avr_io_getirq(avr, AVR_IOCTL_TWI_GETIRQ('0'), TWI_IRQ_INPUT));
+    avr_connect_irq(avr_io_getirq(avr, AVR_IOCTL_TWI_GETIRQ('0'), TWI_IRQ_OUTPUT), lis.irq + TWI_IRQ_OUTPUT);
+
+    lis.regs[0x0F] = 0x41; // WHO_AM_I
+    lis.regs[0x23] = 0x07; // CTRL4 reset value
+    // right side up for the firmware's xyz_down = {0, 12, -9}
+    lis.xyz[0] = 0;
+    lis.xyz[1] = 13107;
+    lis.xyz[2] = -9830;
+}
+
+// ---------------------------------------------------------------------------
+// receiver: PWM on the brushed inputs, 50 Hz servo pulses on the brushless input
+
+typedef struct {
+    char port;
+    uint8_t pin;
+    uint32_t period_us;
+    uint32_t high_us;
+    uint8_t level;
+} pulse_train_t;
+
+static pulse_train_t trains[5] = {
+    { 'D', 0, 500, 0, 0 }, // CTRL_1_A, pins set from --ctrl-pins, periods from --rx-hz
+    { 'D', 1, 500, 0, 0 }, // CTRL_1_B
+    { 'D', 2, 500, 0, 0 }, // CTRL_2_A
+    { 'D', 3, 500, 0, 0 }, // CTRL_2_B
+    { 'E', 0, 20000, 1000, 0 }, // CTRL_3, brushless servo pulse
+};
+
+static int parse_pin(const char* s, char* port, uint8_t* pin) // port letter and bit, e.g. "D2"
+{
+    if (s[0] < 'B' || s[0] > 'E' || s[1] < '0' || s[1] > '7') return 0;
+    *port = s[0];
+    *pin = s[1] - '0';
+    return 1;
+}
+
+static int parse_ctrl_pins(const char* list)
+{
+    for (int i = 0; i < 5; i++) {
+        if (!parse_pin(list, &trains[i].port, &trains[i].pin)) return 0;
+        list += 2;
+        if (*list != (i < 4 ? ',' : '\0')) return 0;
+        list++;
+    }
+    return 1;
+}
+
+static void set_level(pulse_train_t* t, uint8_t level)
+{
+    t->level = level;
+    avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(t->port), t->pin), level);
+}
+
+static avr_cycle_count_t pulse_edge(struct avr_t* a, avr_cycle_count_t when, void* param)
+{
+    pulse_train_t* t = param;
+    uint32_t next_us;
+
+    if (t->high_us == 0 || t->high_us >= t->period_us) {
+        set_level(t, t->high_us != 0); // static level, check again next period
+        next_us = t->period_us;
+    } else if (!t->level) {
+        set_level(t, 1);
+        next_us = t->high_us;
+    } else {
+        set_level(t, 0);
+        next_us = t->period_us - t->high_us;
+    }
+    return when + avr_usec_to_cycles(a, next_us);
+}
+
+// ---------------------------------------------------------------------------
+// stick-to-motor latency
+
+static uint8_t brushed_mask = 0xF0;
+static avr_cycle_count_t step_at = 0;
+static avr_cycle_count_t brushed_response = 0;
+static avr_cycle_count_t brushless_response = 0;
+static avr_cycle_count_t brushless_rise = 0;
+static uint32_t brushless_high_before = 0;
+static avr_cycle_count_t pulse_min = ~(avr_cycle_count_t)0, pulse_max = 0; // ESC pulse widths once the step has settled
+
+static void brushed_pin_hook(struct avr_irq_t* irq, uint32_t value, void* param)
+{
+    (void)param;
+    if (!step_at || avr->cycle < step_at || brushed_response) return;
+    if (!(brushed_mask & (1 << irq->irq))) return;
+    if (!value) brushed_response = avr->cycle; // a bridge input pulled low = drive
+}
+
+static void brushless_pin_hook(struct avr_irq_t* irq, uint32_t value, void* param)
+{
+    (void)irq; (void)param;
+    if (value) {
+        brushless_rise = avr->cycle;
+        return;
+    }
+    if (!brushless_rise) return;
+    avr_cycle_count_t width = avr->cycle - brushless_rise;
+    uint32_t high_us = width * 1000000ULL / avr->frequency;
+    if (brushless_response && avr->cycle > brushless_response + avr_usec_to_cycles(avr, 100000)) {
+        // the command holds still from here, any spread is edge timing
+        if (width < pulse_min) pulse_min = width;
+        if (width > pulse_max) pulse_max = width;
+    }
+    if (!step_at || avr->cycle < step_at) {
+        brushless_high_before = high_us;
+    } else if (!brushless_response && (high_us > brushless_high_before + 20 || high_us + 20 < brushless_high_before)) {
+        brushless_response = avr->cycle;
+    }
+}
+
+static avr_cycle_count_t stick_step(struct avr_t* a, avr_cycle_count_t when, void* param)
+{
+    (void)a; (void)param;
+    step_at = when;
+    trains[0].high_us = trains[0].period_us / 2; // brushed 1 forward, half stick
+    trains[4].high_us = 1750; // weapon half throttle
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+
+static double cycles_to_us(uint64_t c)
+{
+    return c * 1e6 / avr->frequency;
+}
+
+int main(int argc, char** argv)
+{
+    const char* mcu = "atmega328pb";
+    const char* elf = NULL;
+    double seconds = 3, step_s = 1;
+    uint32_t vbat_mv = 11100, rx_hz = 2000, loop_pc = 0, armed_pc = 0, f_cpu = 8000000;
+    const char* brushless_pin = "B6";
+    const char* ctrl_pins = "D0,D1,D2,D3,E0";
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--seconds") && i + 1 < argc) seconds = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--step") && i + 1 < argc) step_s = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--vbat") && i + 1 < argc) vbat_mv = strtoul(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "--rx-hz") && i + 1 < argc) rx_hz = strtoul(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "--loop-pc") && i + 1 < argc) loop_pc = strtoul(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "--armed-pc") && i + 1 < argc) armed_pc = strtoul(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "--brushed-mask") && i + 1 < argc) brushed_mask = strtoul(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "--mcu") && i + 1 < argc) mcu = argv[++i];
+        else if (!strcmp(argv[i], "--f-cpu") && i + 1 < argc) f_cpu = strtoul(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "--brushless-pin") && i + 1 < argc) brushless_pin = argv[++i];
+        else if (!strcmp(argv[i], "--ctrl-pins") && i + 1 < argc) ctrl_pins = argv[++i];
+        else elf = argv[i];
+    }
+    if (!elf) {
+        fprintf(stderr, "usage: %s [options] firmware.elf\n", argv[0]);
+        return 1;
+    }
+    char brushless_port;
+    uint8_t brushless_bit;
+    if (strlen(brushless_pin) != 2 || !parse_pin(brushless_pin, &brushless_port, &brushless_bit)) {
+        fprintf(stderr, "--brushless-pin wants a port letter and bit, e.g. B6\n");
+        return 1;
+    }
+    if (!parse_ctrl_pins(ctrl_pins)) {
+        fprintf(stderr, "--ctrl-pins wants five port letters and bits, e.g. D0,D1,D2,D3,E0\n");
+        return 1;
+    }
+
+    elf_firmware_t fw;
+    memset(&fw, 0, sizeof(fw));
+    if (elf_read_firmware(elf, &fw)) {
+        fprintf(stderr, "can't read %s\n", elf);
+        return 1;
+    }
+
+    avr = avr_make_mcu_by_name(mcu);
+    if (!avr) {
+        fprintf(stderr, "simavr has no core for %s\n", mcu);
+        return 1;
+    }
+    avr_init(avr);
+    avr_load_firmware(avr, &fw);
+    avr->frequency = f_cpu;
+
+    profiler_attach();
+    lis_attach();
+
+    // battery through the 13:1 divider on ADC3
+    avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_ADC_GETIRQ, ADC_IRQ_ADC0 + 3), vbat_mv / 13);
+
+    for (int i = 0; i < 4; i++) trains[i].period_us = 1000000 / rx_hz;
+    for (int i = 0; i < 5; i++) avr_cycle_timer_register_usec(avr, trains[i].period_us, pulse_edge, &trains[i]);
+    avr_cycle_timer_register_usec(avr, step_s * 1e6, stick_step, NULL);
+
+    for (int pin = 0; pin < 8; pin++)
+        avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('D'), pin), brushed_pin_hook, NULL);
+    avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(brushless_port), brushless_bit),
+                            brushless_pin_hook, NULL);
+
+    avr_cycle_count_t end = seconds * avr->frequency;
+    uint64_t loops = 0, sleep_cycles = 0, armed_at = 0;
+    while (avr->cycle < end) {
+        avr_cycle_count_t before = avr->cycle;
+        int sleeping = avr->state == cpu_Sleeping;
+        int state = avr_run(avr);
+        if (sleeping) sleep_cycles += avr->cycle - before;
+        if (state == cpu_Done || state == cpu_Crashed) {
+            fprintf(stderr, "firmware stopped at %llu cycles (state %d)\n", (unsigned long long)avr->cycle, state);
+            break;
+        }
+        if (loop_pc && avr->pc == loop_pc) loops++;
+        if (armed_pc && !armed_at && avr->pc == armed_pc) armed_at = avr->cycle;
+    }
+
+    double total = avr->cycle;
+    uint64_t isr_cycles = 0;
+    printf("%-14s %10s %10s %10s %10s %8s\n", "vector", "count", "avg cyc", "max cyc", "max lat", "cpu %");
+    for (int v = 1; v < VECTORS; v++) {
+        vector_stats_t* s = &stats[v];
+        if (!s->count) continue;
+        isr_cycles += s->cycles;
+        printf("%-14s %10llu %10.1f %10llu %10llu %8.2f\n", vector_names[v], (unsigned long long)s->count,
+               (double)s->cycles / s->count, (unsigned long long)s->max_cycles,
+               (unsigned long long)s->max_latency, 100.0 * s->cycles / total);
+    }
+    printf("interrupt load: %.2f %%\n", 100.0 * isr_cycles / total);
+    printf("idle (sleeping): %.2f %%\n", 100.0 * sleep_cycles / total);
+
+    uint64_t worst_latency = 0;
+    for (int v = 1; v < VECTORS; v++)
+        if (stats[v].max_latency > worst_latency) worst_latency = stats[v].max_latency;
+    printf("worst interrupt latency: %llu cycles (%.1f us)\n", (unsigned long long)worst_latency, cycles_to_us(worst_latency));
+
+    if (loop_pc) printf("control task: %.0f runs/s\n", loops / (total / avr->frequency));
+    if (armed_pc) {
+        if (armed_at) printf("reset to armed: %.1f us\n", cycles_to_us(armed_at));
+        else printf("reset to armed: never\n");
+    }
+    if (brushed_response) printf("stick to brushed pin: %.1f us\n", cycles_to_us(brushed_response - step_at));
+    else printf("stick to brushed pin: no response\n");
+    if (brushless_response) printf("stick to brushless pulse: %.1f us\n", cycles_to_us(brushless_response - step_at));
+    else printf("stick to brushless pulse: no response\n");
+    if (pulse_max) printf("brushless pulse jitter: %.2f us (%llu to %llu cycles)\n", cycles_to_us(pulse_max - pulse_min),
+                          (unsigned long long)pulse_min, (unsigned long long)pulse_max);
+
+    return 0;
+}
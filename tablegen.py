@@ -0,0 +1,199 @@
+#!/usr/bin/env python3
+import argparse
+import sys
+
+# Generates tables.h, the PROGMEM lookup tables that replace runtime divides in the firmware.
+# The Makefile runs this with TABLE_OPTS whenever the Makefile or this script changes.
+#
+# Tables:
+#  duty_recip[p]      | ceil(255*256/p), rx.c turns a pulse into a duty cycle as (high*duty_recip[per >> n]) >> (8 + n)
+#                     | with n the shift that brings the period down to 8 bits
+#  drive_curve[x]     | brushed input 0-255 to duty 0-255, with --drive-deadband and --drive-expo
+#  weapon_curve[x]    | brushless input 0-255 to power 0-255, with --weapon-deadband and --weapon-expo
+#  esc_<proto>[p]     | timer 4 counts from the center pulse for power p (0-255), one table per ESC protocol
+#                     | (motor.c picks the one for BRUSHLESS_PROTOCOL, the compiler drops the others)
+#  bcd_table[x]       | x (0-99) as two BCD digits, tens in the high nibble
+#  blackbox_code[d]   | byte difference d (as int8) to a 4-bit black box step code no larger than d (blackbox.c)
+#  blackbox_step[c]   | step for code c: c < 8 ? c*c : -(16 - c)^2, mod 256
+#  battery_gain[v]    | drive gain for battery voltage v*64 mV, 128 = 1: nominal/measured times the low-voltage limit
+#  battery_limit[v]   | the low-voltage limit alone, for the weapon when BATTERY_COMP_WEAPON is 0 (control.c)
+#
+# Curve options (percent of full scale):
+#  --drive-deadband=<n>  | inputs up to n % read as 0, the rest is stretched back over 0-255 (default 0)
+#  --drive-expo=<n>      | blend of linear and cubic response, 0 = linear, 100 = cubic (default 0)
+#  --weapon-deadband=<n> | same for the weapon channel
+#  --weapon-expo=<n>     |
+#
+# Battery options (see control_battery()):
+#  --battery-nominal-mv=<mv>     | voltage the drive is tuned at, lower readings scale the duty up (default 11100, 3S)
+#  --battery-boost=<n>           | most the duty is scaled up, percent on top of 100 (default 25); the sag under
+#                                | load comes back as more duty, this keeps that loop from running away
+#  --battery-limit-start-mv=<mv> | below this the power limit tapers linearly ... (default 10200)
+#  --battery-limit-end-mv=<mv>   | ... down to --battery-limit-min percent at this voltage and below (default 9600)
+#  --battery-limit-min=<n>       | (default 30)
+#  --battery-min-mv=<mv>         | readings below this are taken as no battery (bench supply, ADC not started) and
+#                                | leave the output alone (default 6000)
+
+# ESC protocols, must match BRUSHLESS_PRESCALER / BRUSHLESS_MIN_US / BRUSHLESS_MAX_US in motor.c
+ESC_PROTOCOLS = [
+    # name,        prescaler, min us, max us
+    ("pwm50",      8,         1000,   2000),
+    ("pwm400",     8,         1000,   2000),
+    ("oneshot125", 1,         125,    250),
+]
+
+def curve(deadband, expo):
+    d = deadband/100.0*255
+    e = expo/100.0
+    out = []
+    for x in range(256):
+        if x <= d:
+            out.append(0)
+            continue
+        v = (x - d)/(255 - d) # 0-1 past the deadband
+        v = v*(1 - e) + v*v*v*e
+        out.append(int(round(v*255)))
+    return out
+
+def duty_recip():
+    return [0] + [-(-255*256 // p) for p in range(1, 256)]
+
+def esc_offsets(f_cpu, prescaler, min_us, max_us):
+    # same rounding as BRUSHLESS_TICKS() in motor.c for the end points
+    lo = f_cpu//1000000*min_us//prescaler
+    hi = f_cpu//1000000*max_us//prescaler
+    half = (hi - lo)/2.0
+    return [int(round(p*half/255)) for p in range(256)]
+
+def bcd():
+    return [((x//10) << 4) | (x % 10) for x in range(100)]
+
+def blackbox_steps():
+    return [c*c if c < 8 else -(16 - c)*(16 - c) for c in range(16)]
+
+def blackbox_code():
+    steps = blackbox_steps()
+    out = []
+    for d in range(256):
+        d = d - 256 if d >= 128 else d
+        # the largest step that doesn't go past d, so a field never overshoots across the byte wrap
+        out.append(max((c for c in range(16) if abs(steps[c]) <= abs(d) and steps[c]*d >= 0),
+                       key=lambda c: abs(steps[c])))
+    return out
+
+BATTERY_STEP_MV = 64 # battery table index is mV >> 6
+
+def battery_limit(start_mv, end_mv, min_percent):
+    out = []
+    for i in range(256):
+        mv = i*BATTERY_STEP_MV + BATTERY_STEP_MV//2 # middle of the step
+        if mv >= start_mv:
+            f = 1.0
+        elif mv <= end_mv:
+            f = min_percent/100.0
+        else:
+            f = min_percent/100.0 + (1 - min_percent/100.0)*(mv - end_mv)/(start_mv - end_mv)
+        out.append(f)
+    return out
+
+def battery_tables(nominal_mv, boost, start_mv, end_mv, min_percent, valid_mv):
+    gain = []
+    limit = []
+    for i, f in enumerate(battery_limit(start_mv, end_mv, min_percent)):
+        mv = i*BATTERY_STEP_MV + BATTERY_STEP_MV//2
+        if mv < valid_mv:
+            gain.append(128)
+            limit.append(128)
+            continue
+        comp = min(nominal_mv/float(mv), 1 + boost/100.0)
+        gain.append(min(255, int(round(128*comp*f))))
+        limit.append(int(round(128*f)))
+    return gain, limit
+
+def emit(out, ctype, name, values, fmt, per_line, comment):
+    out.append("//%s" % comment)
+    out.append("TABLE %s %s[%d] = {" % (ctype, name, len(values)))
+    for i in range(0, len(values), per_line):
+        out.append("    " + ", ".join(fmt % v for v in values[i:i+per_line]) + ",")
+    out.append("};")
+    out.append("")
+
+def percent(s):
+    v = int(s)
+    if v < 0 or v > 100:
+        raise argparse.ArgumentTypeError("%s is not 0-100" % s)
+    return v
+
+def main():
+    p = argparse.ArgumentParser()
+    p.add_argument("--f-cpu", dest="f_cpu", type=int, required=True,
+                   help="CPU clock in Hz, sets the ESC table units")
+    p.add_argument("--drive-deadband", dest="drive_deadband", type=percent, default=0, metavar="n",
+                   help="Brushed input deadband, percent")
+    p.add_argument("--drive-expo", dest="drive_expo", type=percent, default=0, metavar="n",
+                   help="Brushed input expo, percent")
+    p.add_argument("--weapon-deadband", dest="weapon_deadband", type=percent, default=0, metavar="n",
+                   help="Weapon input deadband, percent")
+    p.add_argument("--weapon-expo", dest="weapon_expo", type=percent, default=0, metavar="n",
+                   help="Weapon input expo, percent")
+    p.add_argument("--battery-nominal-mv", dest="battery_nominal_mv", type=int, default=11100, metavar="mv",
+                   help="Battery voltage the output is compensated to")
+    p.add_argument("--battery-boost", dest="battery_boost", type=percent, default=25, metavar="n",
+                   help="Most the compensation scales the output up, percent")
+    p.add_argument("--battery-limit-start-mv", dest="battery_limit_start_mv", type=int, default=10200, metavar="mv",
+                   help="Voltage the low-voltage power limit starts at")
+    p.add_argument("--battery-limit-end-mv", dest="battery_limit_end_mv", type=int, default=9600, metavar="mv",
+                   help="Voltage the power limit reaches its minimum at")
+    p.add_argument("--battery-limit-min", dest="battery_limit_min", type=percent, default=30, metavar="n",
+                   help="Minimum power limit, percent")
+    p.add_argument("--battery-min-mv", dest="battery_min_mv", type=int, default=6000, metavar="mv",
+                   help="Readings below this leave the output alone")
+
+    args = p.parse_args()
+    if args.battery_limit_end_mv >= args.battery_limit_start_mv:
+        p.error("--battery-limit-end-mv must be below --battery-limit-start-mv")
+    if args.battery_nominal_mv <= 0 or args.battery_limit_start_mv >= 256*BATTERY_STEP_MV:
+        p.error("battery voltages must be 1-%d mV" % (256*BATTERY_STEP_MV - 1))
+
+    out = []
+    out.append("#pragma once")
+    out.append("//generated by tablegen.py, do not edit")
+    out.append("//%s" % " ".join(sys.argv[1:]))
+    out.append("")
+    out.append("#include <stdint.h>")
+    out.append("#include <avr/pgmspace.h>")
+    out.append("")
+    out.append("#define TABLES_F_CPU %dUL" % args.f_cpu)
+    out.append("")
+    out.append("//every file includes only the tables it reads, the rest are dropped")
+    out.append("#define TABLE static const PROGMEM __attribute__((unused))")
+    out.append("")
+    emit(out, "uint16_t", "duty_recip", duty_recip(), "%5d", 12,
+         "ceil(255*256/p), p is a period shifted down to 8 bits")
+    emit(out, "uint8_t", "drive_curve", curve(args.drive_deadband, args.drive_expo), "%3d", 16,
+         "brushed input to duty, deadband %d %%, expo %d %%" % (args.drive_deadband, args.drive_expo))
+    emit(out, "uint8_t", "weapon_curve", curve(args.weapon_deadband, args.weapon_expo), "%3d", 16,
+         "brushless input to power, deadband %d %%, expo %d %%" % (args.weapon_deadband, args.weapon_expo))
+    for name, prescaler, min_us, max_us in ESC_PROTOCOLS:
+        emit(out, "uint16_t", "esc_" + name, esc_offsets(args.f_cpu, prescaler, min_us, max_us), "%4d", 16,
+             "%s, timer 4 counts from the center pulse for power 0-255" % name)
+    emit(out, "uint8_t", "bcd_table", bcd(), "0x%02x", 10,
+         "0-99 as packed BCD, tens in the high nibble")
+    emit(out, "uint8_t", "blackbox_code", blackbox_code(), "%2d", 16,
+         "byte difference to the largest black box step code that stays within it, see blackbox_step")
+    emit(out, "uint8_t", "blackbox_step", [v & 0xFF for v in blackbox_steps()], "0x%02x", 16,
+         "0, 1, 4 ... 49, then -64, -49 ... -1")
+    gain, limit = battery_tables(args.battery_nominal_mv, args.battery_boost, args.battery_limit_start_mv,
+                                 args.battery_limit_end_mv, args.battery_limit_min, args.battery_min_mv)
+    emit(out, "uint8_t", "battery_gain", gain, "%3d", 16,
+         "battery mV >> 6 to output gain, 128 = 1: %d mV nominal, up to +%d %%, limit from %d mV to %d %% at %d mV"
+         % (args.battery_nominal_mv, args.battery_boost, args.battery_limit_start_mv, args.battery_limit_min,
+            args.battery_limit_end_mv))
+    emit(out, "uint8_t", "battery_limit", limit, "%3d", 16,
+         "battery mV >> 6 to the low-voltage power limit alone, 128 = 1")
+
+    print("\n".join(out).rstrip("\n"))
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main())